@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+
+// A font size rasterized at build time by bake.GLverse (see tools/bake), as
+// constexpr data of a generated header. Served by TrueTypeFont without any
+// FreeType work; characters outside of the baked charset come from the font
+// file when registered through FontRepository::addBakedFont, else are missing.
+
+struct BakedGlyph
+{
+	char32_t c;
+	FT_Glyph_Metrics metrics;
+	FT_Vector advance;
+	FT_Pos lsb_delta;
+	FT_Pos rsb_delta;
+	int bitmap_left;
+	int bitmap_top;
+	unsigned width; // of the bitmap, in the atlas at (atlas_x, atlas_y)
+	unsigned rows;
+	unsigned atlas_x;
+	unsigned atlas_y;
+};
+
+// pairs with non-zero kerning only, sorted by left, then right
+struct BakedKerning
+{
+	char32_t left;
+	char32_t right;
+	FT_Vector kerning;
+};
+
+struct BakedFont
+{
+	const char* name; // the font file name, without extension
+	FT_Size_Metrics metrics;
+	const BakedGlyph* glyphs; // sorted by character
+	size_t glyph_count;
+	const BakedKerning* kerning;
+	size_t kerning_count;
+	const uint8_t* atlas; // 8-bit coverage, atlas_w bytes per row
+	unsigned atlas_w;
+	unsigned atlas_h;
+};
@@ -1,7 +1,11 @@
 #pragma once
 #include <cmath>
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <codecvt>
+#include <cstdint>
+#include <iterator>
 #include <locale>
 #include <mutex>
 #include <sstream>
@@ -10,7 +14,9 @@
 #include "saturate_add"
 
 #include "FontRepository.h"
+#include "Statistics.h"
 #include "TexelVector.h"
+#include "TextWorkerPool.h"
 #include "TrueTypeFont.h"
 #include "BaseTextRendererGL2.h"
 
@@ -25,6 +31,7 @@ public:
 	typedef string_type StringType;
 	typedef typename string_type::value_type StringValueType;
 	typedef std::basic_stringstream<typename string_type::value_type> StringStreamType;
+	typedef typename renderer_type::Rect Rect;
 
 	union TextColor {
 		struct {
@@ -45,13 +52,83 @@ public:
 		Center = 1,
 		Right = 2,
 	};
+	enum class TextStage {
+		Decode = 0,
+		Wrap = 1,
+		Split = 2,
+		Measure = 3,
+		Raster = 4,
+		Upload = 5,
+	};
+	static constexpr size_t TextStageCount = 6;
+	typedef std::array<size_t, TextStageCount> TextStageRuns;
+
+	// a character together with the font of the chain that provides it
+	struct TextGlyph {
+		TrueTypeFont* font{ nullptr };
+		char32_t c{ 0 };
+	};
+
+	// style of a run of characters, composited into the texels themselves
+	struct TextStyle {
+		std::shared_ptr<TrueTypeFont> font; // nullptr: the font of the text
+		TVE::BGRATexel color{ 255, 255, 255, 255 };
+		FT_Pos spacing{ 0 }; // on top of the text spacing
+		FT_Pos height{ 0 };
+	};
+
+	enum class TextEffectKind {
+		Shadow = 0, // blurred, offset copy of the glyphs
+		Outline = 1, // dilated glyphs
+		Glow = 2, // dilated and blurred glyphs
+	};
+
+	// drawn below the glyphs, in the order given; colors are modulated by the text color
+	struct TextEffect {
+		TextEffectKind kind{ TextEffectKind::Shadow };
+		int radius{ 1 };
+		int offset_x{ 0 };
+		int offset_y{ 0 };
+		TVE::BGRATexel color{ 0, 0, 0, 255 };
+
+		bool operator==(const TextEffect& other) const
+		{
+			return kind == other.kind && radius == other.radius && offset_x == other.offset_x && offset_y == other.offset_y
+				&& color.b == other.color.b && color.g == other.color.g && color.r == other.color.r && color.a == other.color.a;
+		}
+		bool operator!=(const TextEffect& other) const
+		{
+			return !(*this == other);
+		}
+	};
 
 protected:
 	std::shared_ptr<TrueTypeFont> font;
+	std::vector<std::string> fallback_names;
+	std::vector<std::shared_ptr<TrueTypeFont>> fallback_fonts;
+
+protected:
+	template <typename T>
+	using LayoutVector = std::vector<T, MemoryAllocator<T, MemoryCategory::Layout>>;
+
+	LayoutVector<StringType> text_lines;
+	LayoutVector<FT_Pos> text_lines_w;
+	LayoutVector<size_t> text_lines_start;
+	LayoutVector<FT_Pos> text_lines_baseline;
+	// caret x of every character of text relative to the pen of its line (26.6),
+	// prefix sums of the advances as walkLine places them; line i has one more
+	// caret than characters at text_lines_start[i], the last one behind its end
+	LayoutVector<FT_Pos> text_lines_caret;
+	FT_Pos text_lines_extent{ 0 };
+
+protected:
+	// one style index per character of text, empty for plain text; at most
+	// 65536 styles, setStyledText rejects more runs than the index can address
+	std::vector<TextStyle> text_styles;
+	std::vector<uint16_t> text_char_styles;
 
 protected:
-	std::vector<StringType> text_lines;
-	std::vector<FT_Pos> text_lines_w;
+	std::vector<TextEffect> text_effects;
 
 protected:
 	StringType text;
@@ -62,6 +139,31 @@ protected:
 protected:
 	GLtexture texture{};
 
+protected:
+	// screen space, draws are cropped to the intersection of both
+	bool clip_enabled{ false };
+	Rect clip_rect{ 0, 0, 0, 0 };
+	bool group_clip_enabled{ false };
+	Rect group_clip_rect{ 0, 0, 0, 0 };
+
+protected:
+	std::array<std::atomic<size_t>, TextStageCount> stage_runs{};
+
+protected:
+	// what the last takeDamage found on screen, the revision counts uploads
+	struct DrawnState
+	{
+		bool drawn{ false };
+		Rect rect{ 0, 0, 0, 0 }; // visible part, after clipping
+		int origin_x{ 0 };
+		int origin_y{ 0 };
+		GLuint tex_id{ 0 };
+		uint64_t revision{ 0 };
+		TextColor color{ { 0.0f, 0.0f, 0.0f, 0.0f } };
+	};
+	DrawnState drawn_state{};
+	uint64_t texture_revision{ 0 };
+
 protected:
 	FT_Vector text_border{ 0, 0 };
 	FT_Vector text_offset{ 0, 0 };
@@ -89,7 +191,7 @@ public:
 
 	virtual ~BaseText()
 	{
-		glDeleteTextures(1, &texture.tex_id);
+		renderer_type::deleteTexture(texture.tex_id);
 	}
 
 public:
@@ -123,6 +225,8 @@ public:
 		return text_color.a * 100.0f;
 	}
 
+	// layout getters below answer for the last build (measureText, makeText):
+	// setters only take effect there, so call makeText first for current values
 	float getBaseline() const
 	{
 		return static_cast<float>(text_baseline / 64.0);
@@ -163,29 +267,52 @@ public:
 		return text_lines.size() - 1;
 	}
 
+	size_t getStageRuns(TextStage stage) const
+	{
+		return stage_runs[static_cast<size_t>(stage)];
+	}
+
+	TextStageRuns getStageRuns() const
+	{
+		TextStageRuns runs{};
+		for (size_t i = 0; i < TextStageCount; ++i)
+		{
+			runs[i] = stage_runs[i];
+		}
+		return runs;
+	}
+
+protected:
+	void countStage(TextStage stage)
+	{
+		stage_runs[static_cast<size_t>(stage)]++;
+	}
+
 
 public:
 	virtual void setFont(std::shared_ptr<TrueTypeFont> new_font)
 	{
-		std::lock_guard<std::recursive_mutex> lck(base_mutex);
+		StatisticsLock<std::recursive_mutex> lck(base_mutex, Stat::BaseLockWaits, Stat::BaseLockWaitNs);
 
 		font = new_font;
 		text_size = font->getFontHeight();
 		x_height = font->getXHeight();
+		resolveFallbackFonts();
 	}
 
 	virtual void setFont(std::string font_name, int font_size)
 	{
-		std::lock_guard<std::recursive_mutex> lck(base_mutex);
+		StatisticsLock<std::recursive_mutex> lck(base_mutex, Stat::BaseLockWaits, Stat::BaseLockWaitNs);
 
 		font = FontRepository::instance().getFont(font_name, font_size);
 		text_size = font->getFontHeight();
 		x_height = font->getXHeight();
+		resolveFallbackFonts();
 	}
 
 	virtual void setFontSize(int font_size)
 	{
-		std::lock_guard<std::recursive_mutex> lck(base_mutex);
+		StatisticsLock<std::recursive_mutex> lck(base_mutex, Stat::BaseLockWaits, Stat::BaseLockWaitNs);
 
 		if (font)
 		{
@@ -193,23 +320,163 @@ public:
 		}
 	}
 
+	// fonts tried in order for characters the primary font does not cover,
+	// loaded at the pixel size of the primary font; throws for a missing font
+	virtual void setFallbackFonts(std::vector<std::string> font_names)
+	{
+		StatisticsLock<std::recursive_mutex> lck(base_mutex, Stat::BaseLockWaits, Stat::BaseLockWaitNs);
+
+		checkFallbackFonts(font_names, font ? font->getPixelSize() : 0);
+		assignFallbackFonts(std::move(font_names));
+	}
+
+	std::vector<std::string> getFallbackFonts() const
+	{
+		return fallback_names;
+	}
+
+	virtual void setStyles(std::vector<TextStyle> styles, std::vector<uint16_t> char_styles)
+	{
+		StatisticsLock<std::recursive_mutex> lck(base_mutex, Stat::BaseLockWaits, Stat::BaseLockWaitNs);
+
+		for (auto&& style : styles)
+		{
+			style.height = style.font ? style.font->getFontHeight() : 0;
+		}
+		text_styles = std::move(styles);
+		text_char_styles = std::move(char_styles);
+	}
+
+	virtual void setEffects(std::vector<TextEffect> effects)
+	{
+		StatisticsLock<std::recursive_mutex> lck(base_mutex, Stat::BaseLockWaits, Stat::BaseLockWaitNs);
+
+		text_effects = std::move(effects);
+	}
+
+	std::vector<TextEffect> getEffects() const
+	{
+		return text_effects;
+	}
+
+protected:
+	// reports a missing font to the caller of the setter, before anything is built
+	static void checkFallbackFonts(const std::vector<std::string>& font_names, size_t size)
+	{
+		for (auto&& name : font_names)
+		{
+			FontRepository::instance().getFont(name, size);
+		}
+	}
+
+	// unchecked, for names published by a setter that checked them already
+	void assignFallbackFonts(std::vector<std::string> font_names)
+	{
+		StatisticsLock<std::recursive_mutex> lck(base_mutex, Stat::BaseLockWaits, Stat::BaseLockWaitNs);
+
+		fallback_names = std::move(font_names);
+		resolveFallbackFonts();
+	}
+
+	// never throws, it runs when the text is built: missing fonts are left out
+	// and counted (Stat::FallbackFontsSkipped)
+	void resolveFallbackFonts()
+	{
+		fallback_fonts.clear();
+		if (font == nullptr)
+			return;
+
+		auto size = font->getPixelSize();
+		for (auto&& name : fallback_names)
+		{
+			try
+			{
+				fallback_fonts.push_back(FontRepository::instance().getFont(name, size));
+			}
+			catch (const std::exception&)
+			{
+				Statistics::instance().add(Stat::FallbackFontsSkipped);
+			}
+		}
+	}
+
+	// first font of the chain covering c, coverage lookups are O(1); characters
+	// nobody covers show up as U+FFFD (when available), control characters vanish
+	TextGlyph resolveGlyph(char32_t c, TrueTypeFont* primary = nullptr) const
+	{
+		if (primary == nullptr)
+			primary = font.get();
+		if (primary->hasGlyph(c))
+			return { primary, c };
+
+		for (auto&& f : fallback_fonts)
+		{
+			if (f->hasGlyph(c))
+			{
+				Statistics::instance().add(Stat::GlyphFallbacks);
+				return { f.get(), c };
+			}
+		}
+
+		Statistics::instance().add(Stat::GlyphMissing);
+		const char32_t replacement{ 0xFFFD };
+		if (c < 0x20 || c == replacement)
+			return { nullptr, c };
+		if (primary->hasGlyph(replacement))
+			return { primary, replacement };
+		for (auto&& f : fallback_fonts)
+		{
+			if (f->hasGlyph(replacement))
+				return { f.get(), replacement };
+		}
+		return { nullptr, c };
+	}
+
+	// styles apply only while they match the text, character by character
+	bool isStyled(const StringType& s) const
+	{
+		return !text_char_styles.empty() && text_char_styles.size() == s.size();
+	}
+
+	const TextStyle* charStyle(const StringType& s, size_t index) const
+	{
+		if (!isStyled(s))
+			return nullptr;
+		auto style = text_char_styles[index];
+		return style < text_styles.size() ? &text_styles[style] : nullptr;
+	}
+
+	TrueTypeFont* styleFont(const TextStyle* style) const
+	{
+		return (style && style->font) ? style->font.get() : font.get();
+	}
+
+	// kerning pairs exist only within a single font
+	static FT_Vector glyphKerning(const TextGlyph& prev, const TextGlyph& next)
+	{
+		if (prev.font == nullptr || prev.font != next.font)
+			return { 0, 0 };
+		return next.font->getFontKerning(prev.c, next.c);
+	}
+
+public:
 	virtual void setText(StringType new_text)
 	{
-		std::lock_guard<std::recursive_mutex> lck(base_mutex);
+		StatisticsLock<std::recursive_mutex> lck(base_mutex, Stat::BaseLockWaits, Stat::BaseLockWaitNs);
 
 		text = new_text;
 	}
 
 	virtual void setSpacing(float sp = 0.0f)
 	{
-		std::lock_guard<std::recursive_mutex> lck(base_mutex);
+		StatisticsLock<std::recursive_mutex> lck(base_mutex, Stat::BaseLockWaits, Stat::BaseLockWaitNs);
 
 		text_spacing = static_cast<FT_Pos>(std::floor(sp * 64.0));
 	}
 
 	virtual void setLineSpacing(float sp = 0.0f)
 	{
-		std::lock_guard<std::recursive_mutex> lck(base_mutex);
+		StatisticsLock<std::recursive_mutex> lck(base_mutex, Stat::BaseLockWaits, Stat::BaseLockWaitNs);
 
 		text_interline = static_cast<FT_Pos>(std::floor(sp * 64.0));
 	}
@@ -220,7 +487,7 @@ public:
 		text_origin.y = y;
 	}
 
-	void setAlign(TextAlign align)
+	virtual void setAlign(TextAlign align)
 	{
 		text_align = align;
 	}
@@ -257,10 +524,68 @@ public:
 		text_color.b = color.b / 255.0f;
 	}
 
+	void setClipRect(int x, int y, int w, int h)
+	{
+		clip_enabled = true;
+		clip_rect = { x, y, std::max(w, 0), std::max(h, 0) };
+	}
+
+	void clearClipRect()
+	{
+		clip_enabled = false;
+	}
+
+	// clip of the group the text is drawn in, set by its scene
+	void setGroupClip(Rect clip)
+	{
+		group_clip_enabled = true;
+		group_clip_rect = clip;
+	}
+
+	void clearGroupClip()
+	{
+		group_clip_enabled = false;
+	}
+
+	// false when draws are not clipped at all
+	bool getClipRect(Rect& clip) const
+	{
+		if (!clip_enabled && !group_clip_enabled)
+			return false;
+
+		clip = clip_enabled ? clip_rect : group_clip_rect;
+		if (clip_enabled && group_clip_enabled)
+			clip = intersectRect(clip_rect, group_clip_rect);
+		return true;
+	}
+
+	static Rect intersectRect(const Rect& a, const Rect& b)
+	{
+		GLfloat x0 = std::max(a.x, b.x);
+		GLfloat y0 = std::max(a.y, b.y);
+		GLfloat x1 = std::min(a.x + a.w, b.x + b.w);
+		GLfloat y1 = std::min(a.y + a.h, b.y + b.h);
+		return { x0, y0, std::max(x1 - x0, 0.0f), std::max(y1 - y0, 0.0f) };
+	}
+
+	// bounding rectangle of both, empty ones are ignored
+	static Rect unionRect(const Rect& a, const Rect& b)
+	{
+		if (a.w <= 0 || a.h <= 0)
+			return b;
+		if (b.w <= 0 || b.h <= 0)
+			return a;
+		GLfloat x0 = std::min(a.x, b.x);
+		GLfloat y0 = std::min(a.y, b.y);
+		GLfloat x1 = std::max(a.x + a.w, b.x + b.w);
+		GLfloat y1 = std::max(a.y + a.h, b.y + b.h);
+		return { x0, y0, x1 - x0, y1 - y0 };
+	}
+
 public:
 	virtual std::vector<StringType> getLines() const
 	{
-		return text_lines;
+		return { text_lines.begin(), text_lines.end() };
 	}
 
 	template <typename T>
@@ -287,183 +612,735 @@ public:
 
 	virtual void splitText()
 	{
-		std::lock_guard<std::recursive_mutex> lck(base_mutex);
+		StatisticsLock<std::recursive_mutex> lck(base_mutex, Stat::BaseLockWaits, Stat::BaseLockWaitNs);
+		countStage(TextStage::Split);
+		TraceSpan span("splitText");
+		ScopedStatTimer timer(Stat::LayoutNs);
 
 		text_lines.clear();
 		text_lines_w.clear();
+		text_lines_start.clear();
 
 		StringValueType newline{ '\n' };
-		text_lines = split(text, newline);
+		auto lines = split(text, newline);
+		text_lines.assign(std::make_move_iterator(lines.begin()), std::make_move_iterator(lines.end()));
 		text_lines_w.resize(text_lines.size());
+		size_t start = 0;
+		for (auto&& line : text_lines)
+		{
+			text_lines_start.push_back(start);
+			start += line.size() + 1;
+		}
 	}
 
 	virtual void measureText()
 	{
-		std::lock_guard<std::recursive_mutex> lck(base_mutex);
+		StatisticsLock<std::recursive_mutex> lck(base_mutex, Stat::BaseLockWaits, Stat::BaseLockWaitNs);
+		countStage(TextStage::Measure);
+		TraceSpan span("measureText");
+		ScopedStatTimer timer(Stat::LayoutNs);
 
 		text_baseline = 0;
 		text_width = 0;
 		text_height = 0;
+		text_lines_baseline.assign(text_lines.size(), 0);
+		text_lines_caret.assign(text.size() + 1, 0);
+		text_lines_extent = text_size;
 
 		if (text_lines.empty())
 			return;
 
-		for (size_t i = 0; i < 1; ++i)
+		// the first line is placed by its tallest glyph, the text ends with the
+		// deepest descent of the last line, lines in between are one font height
+		// (of the tallest run) apart
+		for (size_t i = 0; i < text_lines.size(); ++i)
 		{
 			FT_Pos line_width = 0;
+			FT_Pos line_height = text_size;
 			FT_Pos max_ascent = 0;
-			StringValueType prev_c = 0;
+			FT_Pos max_descent = 0;
+			size_t index = text_lines_start[i];
+			FT_Pos caret = lineCursor(text_lines[i], index);
+			TextGlyph prev{};
 			for (auto c : text_lines[i])
 			{
-				auto g = font->getGlyphSlot(c);
+				size_t at = index++;
+				auto style = charStyle(text, at);
+				auto glyph = resolveGlyph(c, styleFont(style));
+				auto g = glyph.font ? glyph.font->getGlyphMetrics(glyph.c) : nullptr;
+				text_lines_caret[at] = caret;
 				if (g == nullptr)
 					continue;
 
-				auto kerning = font->getFontKerning(prev_c, c);
-				line_width += g->advance.x + kerning.x + text_spacing;
+				auto kerning = glyphKerning(prev, glyph);
+				FT_Pos advance = g->advance.x + kerning.x + text_spacing + (style ? style->spacing : 0);
+				line_width += advance;
+				text_lines_caret[at] = caret + kerning.x;
+				caret += advance;
+				prev = glyph;
 				max_ascent = std::max(max_ascent, g->metrics.horiBearingY);
+				max_descent = std::max(max_descent, g->metrics.height - g->metrics.horiBearingY);
+				if (style)
+				{
+					line_height = std::max(line_height, style->height);
+				}
 			}
-			text_baseline = max_ascent;
+			text_lines_caret[index] = caret;
 			text_width = std::max(text_width, line_width);
-			text_height += max_ascent;
 			text_lines_w[i] = line_width;
-		}
-		for (size_t i = 1; i < text_lines.size() - 1; ++i)
-		{
-			FT_Pos line_width = 0;
-			StringValueType prev_c = 0;
-			for (auto c : text_lines[i])
+			text_lines_extent = std::max(text_lines_extent, line_height);
+			if (i == 0)
 			{
-				auto g = font->getGlyphSlot(c);
-				if (g == nullptr)
-					continue;
-
-				auto kerning = font->getFontKerning(prev_c, c);
-				line_width += g->advance.x + kerning.x + text_spacing;
+				text_baseline = max_ascent;
+				text_lines_baseline[i] = max_ascent;
 			}
-			text_width = std::max(text_width, line_width);
-			text_lines_w[i] = line_width;
-		}
-		text_height += text_size * (text_lines.size() - 1);
-		text_height += text_interline * (text_lines.size() - 1);
-		for (size_t i = text_lines.size() - 1; i < text_lines.size(); ++i)
-		{
-			FT_Pos line_width = 0;
-			FT_Pos max_descent = 0;
-			StringValueType prev_c = 0;
-			for (auto c : text_lines[i])
+			else
 			{
-				auto g = font->getGlyphSlot(c);
-				if (g == nullptr)
-					continue;
-
-				auto kerning = font->getFontKerning(prev_c, c);
-				line_width += g->advance.x + kerning.x + text_spacing;
-				max_descent = std::max(max_descent, g->metrics.height - g->metrics.horiBearingY);
+				text_lines_baseline[i] = text_lines_baseline[i - 1] + line_height + text_interline;
+			}
+			if (i == text_lines.size() - 1)
+			{
+				text_height = text_lines_baseline[i] + max_descent;
 			}
-			text_width = std::max(text_width, line_width);
-			text_height += max_descent;
-			text_lines_w[i] = line_width;
 		}
 	}
 
 	virtual void prepareText()
 	{
-		std::lock_guard<std::recursive_mutex> lck(base_mutex);
+		StatisticsLock<std::recursive_mutex> lck(base_mutex, Stat::BaseLockWaits, Stat::BaseLockWaitNs);
 
 		splitText();
 		measureText();
 	}
 
-	virtual void makeText()
+	// texture size and placement of the measured text, nothing is composited yet
+	void layoutTexture()
 	{
-		if (font == nullptr) return;
-
-		std::lock_guard<std::recursive_mutex> lck(base_mutex);
+		StatisticsLock<std::recursive_mutex> lck(base_mutex, Stat::BaseLockWaits, Stat::BaseLockWaitNs);
 
-		prepareText();
-
-		text_border.x = std::max<FT_Pos>(3 << 6, (text_size >> 3) >> 6 << 6);
+		text_border.x = std::max<FT_Pos>(3 << 6, (text_size >> 3) >> 6 << 6) + (static_cast<FT_Pos>(effectMargin()) << 6);
 		text_border.y = text_border.x;
+		// tight size, rounding up to the storage size class is up to the renderer
 		texture.tex_w = (text_width + text_border.x * 3) >> 6;
 		texture.tex_h = (text_height + text_border.y * 2) >> 6;
-		texture.tex_w = 2 << static_cast<int>(std::log2(texture.tex_w));
-		texture.tex_h = 2 << static_cast<int>(std::log2(texture.tex_h));
 		text_offset.x = 0 - ((text_border.x) >> 6 << 6);
 		text_offset.y = 0 - ((text_border.y + text_baseline) >> 6 << 6);
 		// fprintf(stderr, "Text: '%s'\n", text.c_str());
 		// fprintf(stderr, "W: %d(%ld), H: %d(%ld)\n", texture.tex_w, text_width, texture.tex_h, text_height);
 		// fprintf(stderr, "OrigX: %ld(%ld), OrigY: %ld(%ld)\n", text_offset.x >> 6, text_offset.x, text_offset.y >> 6, text_offset.y);
+	}
 
-		TexelVector buffer(texture.tex_w, texture.tex_h, { 0, 0, 0, 0 });
-		FT_Pos current_baseline = text_baseline;
-		for (size_t i = 0; i < text_lines.size(); ++i)
+	virtual void makeText()
+	{
+		if (font == nullptr) return;
+
+		StatisticsLock<std::recursive_mutex> lck(base_mutex, Stat::BaseLockWaits, Stat::BaseLockWaitNs);
+
+		prepareText();
+		uploadText(rasterText());
+	}
+
+	virtual TexelVector rasterText()
+	{
+		StatisticsLock<std::recursive_mutex> lck(base_mutex, Stat::BaseLockWaits, Stat::BaseLockWaitNs);
+
+		layoutTexture();
+		return rasterText(0, texture.tex_h);
+	}
+
+	// composites only the texture rows [top, top + rows), lines outside are skipped
+	virtual TexelVector rasterText(int top, int rows)
+	{
+		StatisticsLock<std::recursive_mutex> lck(base_mutex, Stat::BaseLockWaits, Stat::BaseLockWaitNs);
+		countStage(TextStage::Raster);
+		TraceSpan span("rasterText");
+		ScopedStatTimer timer(Stat::CompositeNs);
+		Statistics::instance().add(Stat::CompositeCount);
+
+		TexelVector buffer(texture.tex_w, std::max(rows, 0), { 0, 0, 0, 0 });
+		// a glyph may reach up to one (tallest) font height above or below its baseline,
+		// its effects further by their margin
+		FT_Pos extent = text_lines_extent + (static_cast<FT_Pos>(effectMargin()) << 6);
+		FT_Pos first_baseline = (static_cast<FT_Pos>(top) << 6) - text_border.y - extent;
+		auto first_line = std::lower_bound(text_lines_baseline.begin(), text_lines_baseline.end(), first_baseline) - text_lines_baseline.begin();
+		auto forLines = [&](auto&& composite)
 		{
-			auto&& line = text_lines[i];
+			for (size_t i = first_line; i < text_lines.size(); ++i)
+			{
+				FT_Pos baseline = text_lines_baseline[i];
+				if (((baseline - extent + text_border.y) >> 6) >= top + rows)
+					break;
+
+				composite(text_lines[i], text_border.x + alignShift(i), baseline + text_border.y - (static_cast<FT_Pos>(top) << 6), text_lines_start[i]);
+			}
+		};
 
-			FT_Pos cursor = 0 - (font->getGlyphSlot(line.front())->metrics.horiBearingX >> 6);
-			StringValueType prev_c = 0;
-			for (auto c : line)
+		// each effect is one coverage layer, so overlapping glyphs do not add up
+		CoverageVector layer;
+		for (auto&& effect : text_effects)
+		{
+			layer.assign(buffer.size(), 0);
+			forLines([&](const StringType& line, FT_Pos pen_x, FT_Pos baseline, size_t line_start)
 			{
-				auto g = font->getGlyphSlot(c);
-				if (g == nullptr)
-					continue;
+				compositeEffect(layer, buffer.get_w(), buffer.get_h(), effect, line, pen_x, baseline, line_start);
+			});
+			for (size_t i = 0; i < buffer.size(); ++i)
+			{
+				if (layer[i])
+					overTexel(buffer[i], effect.color, layer[i]);
+			}
+		}
+		forLines([&](const StringType& line, FT_Pos pen_x, FT_Pos baseline, size_t line_start)
+		{
+			compositeLine(buffer, line, pen_x, baseline, line_start);
+		});
+		return buffer;
+	}
+
+	// where the pen of a line starts, left of the bearing of its first glyph
+	FT_Pos lineCursor(const StringType& line, size_t line_start)
+	{
+		if (line.empty())
+			return 0;
+
+		auto style = line_start != StringType::npos ? charStyle(text, line_start) : nullptr;
+		auto first = resolveGlyph(line.front(), styleFont(style));
+		auto first_g = first.font ? first.font->getGlyphMetrics(first.c) : nullptr;
+		return first_g ? 0 - (first_g->metrics.horiBearingX >> 6) : 0;
+	}
+
+	// alignment shift of line i within the text, applied in whole pixels
+	FT_Pos alignShift(size_t i) const
+	{
+		return (((text_width - text_lines_w[i]) >> 6) * static_cast<int>(text_align) / 2) << 6;
+	}
+
+	// visits the glyphs of a line with their pen position (26.6, bearing not applied)
+	template <typename F>
+	void walkLine(const StringType& line, size_t line_start, F&& visit)
+	{
+		if (line.empty())
+			return;
+
+		bool styled = line_start != StringType::npos && isStyled(text);
+		size_t index = line_start;
+		FT_Pos cursor = lineCursor(line, line_start);
+		TextGlyph prev{};
+		for (auto c : line)
+		{
+			auto style = styled ? charStyle(text, index++) : nullptr;
+			auto glyph = resolveGlyph(c, styleFont(style));
+			auto g = glyph.font ? glyph.font->getGlyphSlot(glyph.c) : nullptr;
+			if (g == nullptr)
+				continue;
+
+			auto kerning = glyphKerning(prev, glyph);
+			cursor += kerning.x;
+			// if (kerning.x || kerning.y) fprintf(stderr, "kerning for '%lc' after '%lc' is (%ld,%ld)\n", prev.c, c, kerning.x, kerning.y);
+			visit(glyph, g, cursor, style);
+			cursor += g->advance.x + text_spacing;
+			if (style)
+			{
+				cursor += style->spacing;
+			}
+			prev = glyph;
+		}
+	}
 
-				auto kerning = font->getFontKerning(prev_c, c);
-				cursor += kerning.x;
-				// if (kerning.x || kerning.y) fprintf(stderr, "kerning for '%lc' after '%lc' is (%ld,%ld)\n", prev_c, c, kerning.x, kerning.y);
-				int xoff = (cursor + g->metrics.horiBearingX + text_border.x) >> 6;
-				xoff += static_cast<int>(((text_width - text_lines_w[i]) >> 6) * static_cast<float>(text_align) / 2.0f);
-				int yoff = (current_baseline - g->metrics.horiBearingY + text_border.y) >> 6;
-				for (size_t y = 0; y < g->bitmap.rows; y++)
+	// blends a single line into the buffer, pen and baseline given in buffer coordinates (26.6);
+	// line_start is the index of the line within text, for looking up its styles
+	void compositeLine(TexelVector& buffer, const StringType& line, FT_Pos pen_x, FT_Pos baseline, size_t line_start = StringType::npos)
+	{
+		int buffer_w = static_cast<int>(buffer.get_w());
+		int buffer_h = static_cast<int>(buffer.get_h());
+		// with effects below, glyphs have to cover them instead of adding up with them
+		bool over = !text_effects.empty();
+		walkLine(line, line_start, [&](const TextGlyph&, const TrueTypeGlyph& g, FT_Pos cursor, const TextStyle* style)
+		{
+			int xoff = (cursor + g->metrics.horiBearingX + pen_x) >> 6;
+			int yoff = (baseline - g->metrics.horiBearingY) >> 6;
+			int x0 = std::max(0, -xoff);
+			int y0 = std::max(0, -yoff);
+			int x1 = std::min<int>(g->bitmap.width, buffer_w - xoff);
+			int y1 = std::min<int>(g->bitmap.rows, buffer_h - yoff);
+			for (int y = y0; y < y1; y++)
+			{
+				for (int x = x0; x < x1; x++)
 				{
-					for (size_t x = 0; x < g->bitmap.width; x++)
+					auto&& texel = buffer.at(xoff + x, yoff + y);
+					auto coverage = g->bitmap.buffer[g->bitmap.pitch * y + x];
+					if (over)
+					{
+						overTexel(texel, style ? style->color : TVE::BGRATexel{ 255, 255, 255, 255 }, coverage);
+					}
+					else if (style)
+					{
+						blendTexel(texel, style->color, coverage);
+					}
+					else
 					{
-						auto&& texel = buffer.at(xoff + x, yoff + y);
 						texel.r = 255;
 						texel.g = 255;
 						texel.b = 255;
-						texel.a = saturate_add(texel.a, g->bitmap.buffer[g->bitmap.pitch * y + x]);
-					#ifdef GLYPH_SHADOWS
-						texel.a = saturate_add(texel.a, GLYPH_SHADOWS);
-					#endif
+						texel.a = saturate_add(texel.a, coverage);
 					}
 				}
-				cursor += g->advance.x + text_spacing;
-				prev_c = c;
 			}
-			current_baseline += text_size;
-			current_baseline += text_interline;
+		});
+	}
+
+	// maximum of the effect masks of a line's glyphs into a coverage layer
+	void compositeEffect(CoverageVector& layer, size_t layer_w, size_t layer_h, const TextEffect& effect,
+		const StringType& line, FT_Pos pen_x, FT_Pos baseline, size_t line_start)
+	{
+		auto kind = effect.kind == TextEffectKind::Shadow ? TrueTypeGlyphEffect::Blur
+			: effect.kind == TextEffectKind::Outline ? TrueTypeGlyphEffect::Dilate : TrueTypeGlyphEffect::Glow;
+		int w = static_cast<int>(layer_w);
+		int h = static_cast<int>(layer_h);
+		walkLine(line, line_start, [&](const TextGlyph& glyph, const TrueTypeGlyph& g, FT_Pos cursor, const TextStyle*)
+		{
+			auto mask = glyph.font->getGlyphMask(glyph.c, kind, effect.radius);
+			if (mask == nullptr)
+				return;
+
+			int xoff = ((cursor + g->metrics.horiBearingX + pen_x) >> 6) + mask->left + effect.offset_x;
+			int yoff = ((baseline - g->metrics.horiBearingY) >> 6) + mask->top + effect.offset_y;
+			int x0 = std::max(0, -xoff);
+			int y0 = std::max(0, -yoff);
+			int x1 = std::min(mask->width, w - xoff);
+			int y1 = std::min(mask->rows, h - yoff);
+			for (int y = y0; y < y1; y++)
+			{
+				uint8_t* dst = &layer[static_cast<size_t>(yoff + y) * w + xoff];
+				const uint8_t* src = &mask->coverage[static_cast<size_t>(y) * mask->width];
+				for (int x = x0; x < x1; x++)
+				{
+					dst[x] = std::max(dst[x], src[x]);
+				}
+			}
+		});
+	}
+
+	// texels the effects may reach beyond the glyph boxes
+	int effectMargin() const
+	{
+		int margin = 0;
+		for (auto&& effect : text_effects)
+		{
+			int r = std::min(std::max(effect.radius, 0), 64);
+			int grow = effect.kind == TextEffectKind::Shadow ? 2 * r
+				: effect.kind == TextEffectKind::Glow ? 3 * r : r;
+			margin = std::max(margin, grow + std::max(std::abs(effect.offset_x), std::abs(effect.offset_y)));
+		}
+		return margin;
+	}
+
+	// colored coverage over whatever is below, the way alpha blending puts it on top
+	static void overTexel(TVE::BGRATexel& texel, TVE::BGRATexel color, uint8_t coverage)
+	{
+		unsigned a = coverage * color.a / 255u;
+		if (a == 0)
+			return;
+		if (texel.a == 0)
+		{
+			texel = { color.b, color.g, color.r, static_cast<uint8_t>(a) };
+			return;
 		}
+		unsigned below = texel.a * (255u - a) / 255u;
+		unsigned total = a + below;
+		texel.r = static_cast<uint8_t>((color.r * a + texel.r * below) / total);
+		texel.g = static_cast<uint8_t>((color.g * a + texel.g * below) / total);
+		texel.b = static_cast<uint8_t>((color.b * a + texel.b * below) / total);
+		texel.a = static_cast<uint8_t>(total);
+	}
+
+	// colored coverage over whatever is below, color weighted by coverage
+	static void blendTexel(TVE::BGRATexel& texel, TVE::BGRATexel color, uint8_t coverage)
+	{
+		unsigned a = coverage * color.a / 255u;
+		if (a == 0)
+			return;
+		unsigned total = texel.a + a;
+		texel.r = static_cast<uint8_t>((texel.r * texel.a + color.r * a) / total);
+		texel.g = static_cast<uint8_t>((texel.g * texel.a + color.g * a) / total);
+		texel.b = static_cast<uint8_t>((texel.b * texel.a + color.b * a) / total);
+		texel.a = saturate_add(texel.a, static_cast<uint8_t>(a));
+	}
 
-		glDeleteTextures(1, &texture.tex_id);
-		glGenTextures(1, &texture.tex_id);
-		glBindTexture(GL_TEXTURE_2D, texture.tex_id);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, texture.tex_w, texture.tex_h, 0, GL_BGRA, GL_UNSIGNED_BYTE, buffer.data());
-		glBindTexture(GL_TEXTURE_2D, 0);
+	virtual void uploadText(const TexelVector& buffer)
+	{
+		uploadText(texture, buffer);
+	}
+
+	virtual void uploadText(GLtexture& target, const TexelVector& buffer)
+	{
+		StatisticsLock<std::recursive_mutex> lck(base_mutex, Stat::BaseLockWaits, Stat::BaseLockWaitNs);
+		countStage(TextStage::Upload);
+		TraceSpan span("uploadText");
+		ScopedStatTimer timer(Stat::UploadNs);
+		Statistics::instance().add(Stat::UploadCount);
+		Statistics::instance().add(Stat::UploadBytes, buffer.size() * sizeof(TVE::BGRATexel));
+
+		renderer_type::uploadTexture(target, buffer);
+		texture_revision++;
+	}
+
+	virtual bool uploadTextRegion(GLtexture& target, const TexelVector& buffer, int x, int y)
+	{
+		StatisticsLock<std::recursive_mutex> lck(base_mutex, Stat::BaseLockWaits, Stat::BaseLockWaitNs);
+		countStage(TextStage::Upload);
+		TraceSpan span("uploadTextRegion");
+		ScopedStatTimer timer(Stat::UploadNs);
+		Statistics::instance().add(Stat::UploadCount);
+		Statistics::instance().add(Stat::UploadBytes, buffer.size() * sizeof(TVE::BGRATexel));
+
+		texture_revision++;
+		return renderer_type::uploadTextureRegion(target, buffer, x, y);
 	}
 
 public:
 	float measureString(StringType s)
 	{
 		FT_Pos string_width = 0;
-		StringValueType prev_c = 0;
+		TextGlyph prev{};
 		for (auto c : s)
 		{
-			auto g = font->getGlyphSlot(c);
+			auto glyph = resolveGlyph(c);
+			auto g = glyph.font ? glyph.font->getGlyphMetrics(glyph.c) : nullptr;
 			if (g == nullptr)
 				continue;
 
-			auto kerning = font->getFontKerning(prev_c, c);
+			auto kerning = glyphKerning(prev, glyph);
 			string_width += g->advance.x + kerning.x + text_spacing;
+			prev = glyph;
 		}
 		return static_cast<float>(string_width / 64.0);
 	}
 
+	// width of s[first, last), with the styles of the text when s is the styled text
+	float measureSpan(const StringType& s, size_t first, size_t last)
+	{
+		if (!isStyled(s))
+			return measureString(s.substr(first, last - first));
+
+		FT_Pos span_width = 0;
+		TextGlyph prev{};
+		for (size_t i = first; i < last && i < s.size(); ++i)
+		{
+			auto style = charStyle(s, i);
+			auto glyph = resolveGlyph(s[i], styleFont(style));
+			auto g = glyph.font ? glyph.font->getGlyphMetrics(glyph.c) : nullptr;
+			if (g == nullptr)
+				continue;
+
+			auto kerning = glyphKerning(prev, glyph);
+			span_width += g->advance.x + kerning.x + text_spacing + (style ? style->spacing : 0);
+			prev = glyph;
+		}
+		return static_cast<float>(span_width / 64.0);
+	}
+
+	// measureString of count strings at once, in pixels: widths[i], and heights[i]
+	// (ascent plus descent of its glyphs, as for a one line text) unless nullptr.
+	// Glyphs and kerning are resolved per font for many strings under one lock;
+	// large batches are split across the worker pool (so not from one of its jobs),
+	// which measures from a copy of the metrics and kerning and takes no font lock
+	void measureStrings(const StringType* strings, size_t count, float* widths, float* heights = nullptr)
+	{
+		StatisticsLock<std::recursive_mutex> lck(base_mutex, Stat::BaseLockWaits, Stat::BaseLockWaitNs);
+		TraceSpan span("measureStrings");
+		ScopedStatTimer timer(Stat::LayoutNs);
+
+		// characters per job, smaller batches are not worth a thread
+		const size_t job_chars = 1 << 14;
+		size_t total = 0;
+		for (size_t i = 0; i < count; ++i)
+			total += strings[i].size();
+		size_t jobs = std::min(total / job_chars, TextWorkerPool::instance().getThreadCount() + 1);
+		if (jobs <= 1)
+		{
+			measureBatch(strings, count, widths, heights);
+			return;
+		}
+
+		MeasureTable table;
+		if (!makeMeasureTable(strings, count, table))
+		{
+			measureBatch(strings, count, widths, heights);
+			return;
+		}
+
+		// about as many characters per job, the last one is measured here
+		std::vector<std::future<void>> pending;
+		size_t first = 0;
+		size_t chars = 0;
+		for (size_t i = 0; i < count && pending.size() + 1 < jobs; ++i)
+		{
+			chars += strings[i].size();
+			if (chars >= total / jobs)
+			{
+				size_t last = i + 1;
+				pending.push_back(TextWorkerPool::instance().submit([=, &table] { measureFromTable(table, strings + first, last - first, widths + first, heights ? heights + first : nullptr); }));
+				first = last;
+				chars = 0;
+			}
+		}
+		measureFromTable(table, strings + first, count - first, widths + first, heights ? heights + first : nullptr);
+		for (auto&& job : pending)
+			job.get();
+	}
+
+protected:
+	// metrics of a distinct character of a batch, see makeMeasureTable
+	struct MeasureGlyph {
+		bool found{ false };
+		size_t font{ 0 };
+		size_t slot{ 0 }; // among the found glyphs of its font
+		FT_Pos advance{ 0 };
+		FT_Pos ascent{ 0 };
+		FT_Pos descent{ 0 };
+	};
+
+	struct MeasureTable {
+		std::vector<char32_t> chars; // sorted
+		std::vector<MeasureGlyph> glyphs; // of chars[i]
+		std::vector<size_t> slots; // per font
+		std::vector<std::vector<FT_Pos>> kerning; // per font, slots x slots (left major), empty if it does not kern
+	};
+
+	// copies the metrics of the distinct characters of the strings, and the kerning of
+	// all their pairs, with one lock per font; false if a kerning font has too many
+	// glyphs in the batch for all pairs to be worth copying
+	bool makeMeasureTable(const StringType* strings, size_t count, MeasureTable& table)
+	{
+		const size_t max_pairs = 1 << 14;
+
+		char32_t last = 0;
+		for (size_t i = 0; i < count; ++i)
+		{
+			for (auto c : strings[i])
+				last = std::max<char32_t>(last, c);
+		}
+		if (last > 0x10FFFF)
+			return false;
+		std::vector<uint64_t> seen(last / 64 + 1, 0);
+		for (size_t i = 0; i < count; ++i)
+		{
+			for (auto c : strings[i])
+				seen[c >> 6] |= uint64_t{ 1 } << (c & 63);
+		}
+		for (size_t w = 0; w < seen.size(); ++w)
+		{
+			for (char32_t b = 0; seen[w] && b < 64; ++b)
+			{
+				if (seen[w] >> b & 1)
+					table.chars.push_back(static_cast<char32_t>(w * 64 + b));
+			}
+		}
+
+		std::vector<TrueTypeFont*> fonts{ font.get() };
+		for (auto&& f : fallback_fonts)
+			fonts.push_back(f.get());
+
+		std::vector<TextGlyph> resolved(table.chars.size());
+		for (size_t i = 0; i < table.chars.size(); ++i)
+			resolved[i] = resolveGlyph(table.chars[i]);
+
+		table.glyphs.resize(table.chars.size());
+		table.slots.assign(fonts.size(), 0);
+		table.kerning.resize(fonts.size());
+		std::vector<char32_t> cs;
+		std::vector<size_t> at;
+		std::vector<const TrueTypeGlyphMetrics*> found;
+		std::vector<char32_t> left;
+		std::vector<char32_t> right;
+		for (size_t f = 0; f < fonts.size(); ++f)
+		{
+			cs.clear();
+			at.clear();
+			for (size_t i = 0; i < resolved.size(); ++i)
+			{
+				if (resolved[i].font == fonts[f])
+				{
+					cs.push_back(resolved[i].c);
+					at.push_back(i);
+				}
+			}
+			if (cs.empty())
+				continue;
+			found.resize(cs.size());
+			fonts[f]->getGlyphMetrics(cs.data(), cs.size(), found.data());
+
+			// missing glyphs are skipped between neighbours, they get no slot
+			size_t slots = 0;
+			for (size_t j = 0; j < cs.size(); ++j)
+			{
+				if (found[j] == nullptr)
+					continue;
+				auto&& g = table.glyphs[at[j]];
+				g.found = true;
+				g.font = f;
+				g.slot = slots;
+				g.advance = found[j]->advance.x;
+				g.ascent = found[j]->metrics.horiBearingY;
+				g.descent = found[j]->metrics.height - found[j]->metrics.horiBearingY;
+				cs[slots++] = cs[j];
+			}
+			table.slots[f] = slots;
+			if (slots < 2 || !fonts[f]->hasKerning())
+				continue;
+			if (slots * slots > max_pairs)
+				return false;
+
+			left.clear();
+			right.clear();
+			for (size_t l = 0; l < slots; ++l)
+			{
+				for (size_t r = 0; r < slots; ++r)
+				{
+					left.push_back(cs[l]);
+					right.push_back(cs[r]);
+				}
+			}
+			table.kerning[f].resize(left.size());
+			fonts[f]->getFontKerning(left.data(), right.data(), left.size(), table.kerning[f].data());
+		}
+		return true;
+	}
+
+	// as measureBatch, from the copy only
+	void measureFromTable(const MeasureTable& table, const StringType* strings, size_t count, float* widths, float* heights) const
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			FT_Pos width = 0;
+			FT_Pos ascent = 0;
+			FT_Pos descent = 0;
+			const MeasureGlyph* prev = nullptr;
+			for (auto c : strings[i])
+			{
+				auto&& g = table.glyphs[std::lower_bound(table.chars.begin(), table.chars.end(), c) - table.chars.begin()];
+				if (!g.found)
+					continue;
+				width += g.advance + text_spacing;
+				auto&& kerning = table.kerning[g.font];
+				if (prev && prev->font == g.font && !kerning.empty())
+					width += kerning[prev->slot * table.slots[g.font] + g.slot];
+				ascent = std::max(ascent, g.ascent);
+				descent = std::max(descent, g.descent);
+				prev = &g;
+			}
+			widths[i] = static_cast<float>(width / 64.0);
+			if (heights)
+				heights[i] = static_cast<float>((ascent + descent) / 64.0);
+		}
+	}
+
+	// the glyphs of all strings in one array, so each font is asked once for all
+	// its metrics and kerning pairs, and the advances are summed in flat loops
+	void measureBatch(const StringType* strings, size_t count, float* widths, float* heights)
+	{
+		std::vector<TextGlyph> glyphs;
+		std::vector<size_t> ends(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			for (auto c : strings[i])
+				glyphs.push_back(resolveGlyph(c));
+			ends[i] = glyphs.size();
+		}
+
+		std::vector<TrueTypeFont*> fonts{ font.get() };
+		for (auto&& f : fallback_fonts)
+			fonts.push_back(f.get());
+
+		std::vector<const TrueTypeGlyphMetrics*> metrics(glyphs.size(), nullptr);
+		std::vector<char32_t> cs;
+		std::vector<size_t> at;
+		std::vector<const TrueTypeGlyphMetrics*> found;
+		for (auto f : fonts)
+		{
+			cs.clear();
+			at.clear();
+			for (size_t k = 0; k < glyphs.size(); ++k)
+			{
+				if (glyphs[k].font == f)
+				{
+					cs.push_back(glyphs[k].c);
+					at.push_back(k);
+				}
+			}
+			if (cs.empty())
+				continue;
+			found.resize(cs.size());
+			f->getGlyphMetrics(cs.data(), cs.size(), found.data());
+			for (size_t j = 0; j < at.size(); ++j)
+				metrics[at[j]] = found[j];
+		}
+
+		// kerning between neighbours of one font within a string, missing glyphs are skipped
+		std::vector<FT_Pos> advances(glyphs.size(), 0);
+		std::vector<char32_t> left;
+		std::vector<FT_Pos> kerning;
+		for (auto f : fonts)
+		{
+			left.clear();
+			cs.clear();
+			at.clear();
+			size_t begin = 0;
+			for (size_t i = 0; i < count; ++i)
+			{
+				const TextGlyph* prev = nullptr;
+				for (size_t k = begin; k < ends[i]; ++k)
+				{
+					if (metrics[k] == nullptr)
+						continue;
+					if (prev && prev->font == f && glyphs[k].font == f)
+					{
+						left.push_back(prev->c);
+						cs.push_back(glyphs[k].c);
+						at.push_back(k);
+					}
+					prev = &glyphs[k];
+				}
+				begin = ends[i];
+			}
+			if (cs.empty())
+				continue;
+			kerning.resize(cs.size());
+			f->getFontKerning(left.data(), cs.data(), cs.size(), kerning.data());
+			for (size_t j = 0; j < at.size(); ++j)
+				advances[at[j]] = kerning[j];
+		}
+
+		for (size_t k = 0; k < glyphs.size(); ++k)
+		{
+			if (metrics[k])
+				advances[k] += metrics[k]->advance.x + text_spacing;
+		}
+		size_t begin = 0;
+		for (size_t i = 0; i < count; ++i)
+		{
+			FT_Pos width = 0;
+			for (size_t k = begin; k < ends[i]; ++k)
+				width += advances[k];
+			widths[i] = static_cast<float>(width / 64.0);
+			if (heights)
+			{
+				FT_Pos ascent = 0;
+				FT_Pos descent = 0;
+				for (size_t k = begin; k < ends[i]; ++k)
+				{
+					if (metrics[k] == nullptr)
+						continue;
+					ascent = std::max(ascent, metrics[k]->metrics.horiBearingY);
+					descent = std::max(descent, metrics[k]->metrics.height - metrics[k]->metrics.horiBearingY);
+				}
+				heights[i] = static_cast<float>((ascent + descent) / 64.0);
+			}
+			begin = ends[i];
+		}
+	}
+
 public:
 	float transition(float x, float xoff, float yoff)
 	{
@@ -494,9 +1371,135 @@ public:
 		y += text_offset.y >> 6;
 		transformOrigin(x, y);
 		auto c = text_color;
-		renderer_type::drawTexture(texture.tex_id, { x, y, w, h }, { c.r, c.g, c.b, c.a });
+		drawClipped(texture.tex_id, { x, y, w, h }, { c.r, c.g, c.b, c.a }, { 0.0f, 0.0f, texture.tex_u, texture.tex_v });
+	}
+
+	// screen rectangle covered by drawText(x, y), as of the last build
+	virtual Rect getTextRect(int x, int y)
+	{
+		x += text_offset.x >> 6;
+		y += text_offset.y >> 6;
+		transformOrigin(x, y);
+		return { x, y, texture.tex_w, texture.tex_h };
+	}
+
+	// index of the caret in text nearest to (x, y), relative to the position given
+	// to drawText, as of the last build; O(log n) over lines and their carets
+	virtual size_t hitTest(int x, int y)
+	{
+		StatisticsLock<std::recursive_mutex> lck(base_mutex, Stat::BaseLockWaits, Stat::BaseLockWaitNs);
+		if (text_lines.empty() || text_lines_caret.size() != text.size() + 1)
+			return 0;
+
+		int left = 0, top = 0;
+		textureOrigin(left, top);
+		// the line whose band, from its ascender down to the next one, holds y
+		FT_Pos ascender = font ? font->getAscender() : text_size;
+		FT_Pos ty = (static_cast<FT_Pos>(y - top) << 6) - text_border.y;
+		auto line = std::upper_bound(text_lines_baseline.begin(), text_lines_baseline.end(), ty + ascender) - text_lines_baseline.begin();
+		size_t i = line > 0 ? static_cast<size_t>(line - 1) : 0;
+
+		// the nearer of the carets around x
+		FT_Pos tx = (static_cast<FT_Pos>(x - left) << 6) - text_border.x - alignShift(i);
+		auto first = text_lines_caret.begin() + text_lines_start[i];
+		auto last = first + text_lines[i].size() + 1;
+		auto it = std::lower_bound(first, last, tx);
+		if (it == last)
+			--it;
+		else if (it != first && tx - *(it - 1) < *it - tx)
+			--it;
+		return static_cast<size_t>(it - text_lines_caret.begin());
+	}
+
+	// caret before text[index] (one pixel wide, one font height tall), in the
+	// coordinates of hitTest; indices past the end are clamped to it
+	virtual Rect caretRect(size_t index)
+	{
+		StatisticsLock<std::recursive_mutex> lck(base_mutex, Stat::BaseLockWaits, Stat::BaseLockWaitNs);
+		if (text_lines.empty() || text_lines_caret.size() != text.size() + 1)
+			return { 0, 0, 0, 0 };
+
+		index = std::min(index, text.size());
+		size_t i = std::upper_bound(text_lines_start.begin(), text_lines_start.end(), index) - text_lines_start.begin() - 1;
+		int left = 0, top = 0;
+		textureOrigin(left, top);
+		FT_Pos ascender = font ? font->getAscender() : text_size;
+		FT_Pos cx = text_lines_caret[index] + text_border.x + alignShift(i);
+		FT_Pos cy = text_lines_baseline[i] + text_border.y - ascender;
+		return { left + static_cast<GLfloat>(cx / 64.0), top + static_cast<GLfloat>(cy / 64.0), 1.0f, static_cast<GLfloat>(text_size / 64.0) };
 	}
 
+	// screen area changed since the last call for the text drawn at (x, y): where
+	// it was and where it is now, when its content, position, color or clip changed;
+	// false when drawing it again would not change a pixel
+	virtual bool takeDamage(int x, int y, Rect& damage)
+	{
+		return updateDamage(getTextRect(x, y), x, y, damage);
+	}
+
+protected:
+	bool updateDamage(const Rect& rect, int x, int y, Rect& damage)
+	{
+		StatisticsLock<std::recursive_mutex> lck(base_mutex, Stat::BaseLockWaits, Stat::BaseLockWaitNs);
+		DrawnState now;
+		now.drawn = rect.w > 0 && rect.h > 0;
+		now.rect = rect;
+		Rect clip{ 0, 0, 0, 0 };
+		if (getClipRect(clip))
+			now.rect = intersectRect(rect, clip);
+		now.origin_x = x;
+		now.origin_y = y;
+		textureOrigin(now.origin_x, now.origin_y);
+		now.tex_id = texture.tex_id;
+		now.revision = texture_revision;
+		now.color = text_color;
+
+		auto&& last = drawn_state;
+		bool same = now.drawn == last.drawn;
+		if (same && now.drawn)
+		{
+			same = now.rect.x == last.rect.x && now.rect.y == last.rect.y && now.rect.w == last.rect.w && now.rect.h == last.rect.h
+				&& now.origin_x == last.origin_x && now.origin_y == last.origin_y
+				&& now.tex_id == last.tex_id && now.revision == last.revision
+				&& std::equal(now.color.color4fv, now.color.color4fv + 4, last.color.color4fv);
+		}
+		if (same)
+			return false;
+
+		damage = unionRect(last.drawn ? last.rect : Rect{ 0, 0, 0, 0 }, now.drawn ? now.rect : Rect{ 0, 0, 0, 0 });
+		drawn_state = now;
+		return damage.w > 0 && damage.h > 0;
+	}
+
+	// screen position of the first texel of the texture drawn by drawText(x, y)
+	virtual void textureOrigin(int& x, int& y)
+	{
+		x += text_offset.x >> 6;
+		y += text_offset.y >> 6;
+		transformOrigin(x, y);
+	}
+
+protected:
+	// crops the quad and its texture coordinates alike, nothing is submitted when it is clipped away
+	void drawClipped(GLuint tex_id, Rect r, typename renderer_type::Color c, Rect uv)
+	{
+		Rect clip{ 0, 0, 0, 0 };
+		if (getClipRect(clip))
+		{
+			auto visible = intersectRect(r, clip);
+			if (visible.w <= 0 || visible.h <= 0)
+				return;
+
+			GLfloat su = r.w > 0 ? uv.w / r.w : 0.0f;
+			GLfloat sv = r.h > 0 ? uv.h / r.h : 0.0f;
+			uv = { uv.x + (visible.x - r.x) * su, uv.y + (visible.y - r.y) * sv, visible.w * su, visible.h * sv };
+			r = visible;
+		}
+		renderer_type::drawTexture(tex_id, r, c, uv);
+	}
+
+public:
+
 	void drawBounds(int x, int y)
 	{
 		int w = texture.tex_w;
@@ -1,7 +1,11 @@
 #pragma once
 #include "OpenGL.h"
+#include "TexelVector.h"
+#include "TextureManager.h"
 
 
+// Texture storage is owned by TextureManager: call its nextFrame() once per frame
+// after the text draws, otherwise uploads are not staged and frames are inferred
 class BaseTextRendererGL2
 {
 public:
@@ -63,21 +67,48 @@ public:
 	};
 
 public:
-	static void drawTexture(GLuint texture, Rect r, Color c)
+	static void uploadTexture(GLtexture& texture, const TexelVector& buffer)
 	{
+		TextureManager::instance().upload(texture, buffer);
+	}
+
+	// false when the texture has no storage (never uploaded or evicted)
+	static bool uploadTextureRegion(GLtexture& texture, const TexelVector& buffer, int x, int y)
+	{
+		return TextureManager::instance().uploadRegion(texture, buffer, x, y);
+	}
+
+	static void deleteTexture(GLuint& texture)
+	{
+		// no GL call for texts that never reached the GPU (e.g. headless use)
+		if (texture != 0)
+		{
+			TextureManager::instance().release(texture);
+		}
+	}
+
+	static bool isTextureResident(GLuint texture)
+	{
+		return TextureManager::instance().isResident(texture);
+	}
+
+public:
+	static void drawTexture(GLuint texture, Rect r, Color c, Rect uv = { 0.0f, 0.0f, 1.0f, 1.0f })
+	{
+		TextureManager::instance().touch(texture);
 		glEnable(GL_BLEND);
 		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		glEnable(GL_TEXTURE_2D);
 		glBindTexture(GL_TEXTURE_2D, texture);
 		glColor4fv(c);
 		glBegin(GL_QUADS);
-			glTexCoord2f(0.0f, 0.0f);
+			glTexCoord2f(uv.x, uv.y);
 			glVertex2f(r.x, r.y);
-			glTexCoord2f(1.0f, 0.0f);
+			glTexCoord2f(uv.x + uv.w, uv.y);
 			glVertex2f(r.x + r.w, r.y);
-			glTexCoord2f(1.0f, 1.0f);
+			glTexCoord2f(uv.x + uv.w, uv.y + uv.h);
 			glVertex2f(r.x + r.w, r.y + r.h);
-			glTexCoord2f(0.0f, 1.0f);
+			glTexCoord2f(uv.x, uv.y + uv.h);
 			glVertex2f(r.x, r.y + r.h);
 		glEnd();
 		glDisable(GL_TEXTURE_2D);
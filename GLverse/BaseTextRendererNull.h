@@ -0,0 +1,67 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include "BaseTextRendererGL2.h"
+#include "TexelVector.h"
+
+
+// Renderer without any GL calls, for headless runs (benchmarks, stress tests).
+// Uploads only hand out texture names, draws are merely counted.
+class BaseTextRendererNull
+{
+public:
+	typedef BaseTextRendererGL2::Point Point;
+	typedef BaseTextRendererGL2::Rect Rect;
+	typedef BaseTextRendererGL2::Color Color;
+
+private:
+	static std::atomic<uint64_t>& drawCounter()
+	{
+		static std::atomic<uint64_t> draws{ 0 };
+		return draws;
+	}
+
+public:
+	static uint64_t getDrawCount()
+	{
+		return drawCounter().load(std::memory_order_relaxed);
+	}
+
+public:
+	static void uploadTexture(GLtexture& texture, const TexelVector& buffer)
+	{
+		static std::atomic<GLuint> next_texture{ 1 };
+		if (texture.tex_id == 0 && !buffer.empty())
+		{
+			texture.tex_id = next_texture++;
+		}
+		texture.tex_u = 1.0f;
+		texture.tex_v = 1.0f;
+	}
+
+	static bool uploadTextureRegion(GLtexture& texture, const TexelVector&, int, int)
+	{
+		return texture.tex_id != 0;
+	}
+
+	static void deleteTexture(GLuint& texture)
+	{
+		texture = 0;
+	}
+
+	static bool isTextureResident(GLuint)
+	{
+		return true;
+	}
+
+public:
+	static void drawTexture(GLuint, Rect, Color, Rect = { 0.0f, 0.0f, 1.0f, 1.0f })
+	{
+		drawCounter().fetch_add(1, std::memory_order_relaxed);
+	}
+
+	static void drawRect(Rect, Color, float = 1) {}
+	static void drawLine(Point, Point, Color, float = 1) {}
+	static void drawCrosshair(Point, float, Color, float = 1) {}
+
+};
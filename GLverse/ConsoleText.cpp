@@ -0,0 +1,402 @@
+#include "ConsoleText.h"
+#include "BaseTextRendererNull.h"
+#include <algorithm>
+#include <deque>
+
+
+template <typename renderer_type>
+BasicConsoleText<renderer_type>::BasicConsoleText(std::string font_name, int font_size, int width, size_t max_lines):
+	Base(font_name, font_size),
+	max_lines{ std::max<size_t>(1, max_lines) },
+	console_width{ std::max(1, width) }
+{
+	ring.resize(this->max_lines);
+}
+
+template <typename renderer_type>
+BasicConsoleText<renderer_type>::BasicConsoleText(std::shared_ptr<TrueTypeFont> font_ptr, int width, size_t max_lines):
+	Base(font_ptr),
+	max_lines{ std::max<size_t>(1, max_lines) },
+	console_width{ std::max(1, width) }
+{
+	ring.resize(this->max_lines);
+}
+
+template <typename renderer_type>
+void BasicConsoleText<renderer_type>::pushOp(ConsoleOp op)
+{
+	std::lock_guard<std::mutex> lck(pending_mutex);
+	pending_ops.push_back(std::move(op));
+}
+
+template <typename renderer_type>
+void BasicConsoleText<renderer_type>::append(std::string text)
+{
+	// decoding is deferred to the render thread
+	pushOp({ ConsoleOpKind::Append, std::move(text), {}, 0 });
+}
+
+template <typename renderer_type>
+void BasicConsoleText<renderer_type>::append(StringType text)
+{
+	pushOp({ ConsoleOpKind::Append, {}, std::move(text), 0 });
+}
+
+template <typename renderer_type>
+void BasicConsoleText<renderer_type>::trim(size_t lines)
+{
+	pushOp({ ConsoleOpKind::Trim, {}, {}, lines });
+}
+
+template <typename renderer_type>
+void BasicConsoleText<renderer_type>::clear()
+{
+	pushOp({ ConsoleOpKind::Clear, {}, {}, 0 });
+}
+
+template <typename renderer_type>
+void BasicConsoleText<renderer_type>::setFont(std::shared_ptr<TrueTypeFont> font_ptr)
+{
+	std::lock_guard<std::mutex> lck(pending_mutex);
+	pending_font = font_ptr;
+}
+
+template <typename renderer_type>
+void BasicConsoleText<renderer_type>::setFont(std::string font_name, int font_size)
+{
+	setFont(FontRepository::instance().getFont(font_name, font_size));
+}
+
+template <typename renderer_type>
+void BasicConsoleText<renderer_type>::setFontSize(int font_size)
+{
+	std::string font_name;
+	{
+		std::lock_guard<std::mutex> lck(pending_mutex);
+		font_name = (pending_font ? pending_font : font)->getFontName();
+	}
+	setFont(font_name, font_size);
+}
+
+template <typename renderer_type>
+void BasicConsoleText<renderer_type>::setFallbackFonts(std::vector<std::string> font_names)
+{
+	// a missing font throws here, on the thread of the caller, not in makeText
+	std::lock_guard<std::mutex> lck(pending_mutex);
+	Base::checkFallbackFonts(font_names, (pending_font ? pending_font : font)->getPixelSize());
+	pending_fallback = std::make_unique<std::vector<std::string>>(std::move(font_names));
+}
+
+template <typename renderer_type>
+size_t BasicConsoleText<renderer_type>::getLineCount() const
+{
+	std::lock_guard<std::mutex> lck(console_mutex);
+	return ring_count;
+}
+
+template <typename renderer_type>
+size_t BasicConsoleText<renderer_type>::getMaxLines() const
+{
+	return max_lines;
+}
+
+template <typename renderer_type>
+std::vector<typename BasicConsoleText<renderer_type>::StringType> BasicConsoleText<renderer_type>::getLines() const
+{
+	std::lock_guard<std::mutex> lck(console_mutex);
+	std::vector<StringType> lines;
+	lines.reserve(ring_count);
+	for (size_t i = 0; i < ring_count; ++i)
+	{
+		lines.push_back(ring[(ring_head + i) % max_lines]);
+	}
+	return lines;
+}
+
+template <typename renderer_type>
+void BasicConsoleText<renderer_type>::wrapLine(const StringType& line, std::vector<StringType>& lines)
+{
+	// greedy wrap at the last space, words longer than the console are broken anywhere
+	FT_Pos max_width = (static_cast<FT_Pos>(console_width) << 6) - text_border.x * 2;
+	size_t start = 0;
+	size_t last_space = StringType::npos;
+	FT_Pos line_width = 0;
+	TextGlyph prev{};
+	for (size_t i = 0; i < line.size(); ++i)
+	{
+		auto c = line[i];
+		auto glyph = Base::resolveGlyph(c);
+		auto g = glyph.font ? glyph.font->getGlyphMetrics(glyph.c) : nullptr;
+		if (g == nullptr)
+			continue;
+
+		FT_Pos advance = g->advance.x + Base::glyphKerning(prev, glyph).x + text_spacing;
+		if (line_width + advance > max_width && i > start)
+		{
+			size_t end = (last_space != StringType::npos) ? last_space : i;
+			lines.push_back(line.substr(start, end - start));
+			start = (last_space != StringType::npos) ? last_space + 1 : i;
+			last_space = StringType::npos;
+			line_width = 0;
+			prev = {};
+			for (size_t j = start; j < i; ++j)
+			{
+				auto glyph_j = Base::resolveGlyph(line[j]);
+				auto m = glyph_j.font ? glyph_j.font->getGlyphMetrics(glyph_j.c) : nullptr;
+				if (m == nullptr)
+					continue;
+				line_width += m->advance.x + Base::glyphKerning(prev, glyph_j).x + text_spacing;
+				prev = glyph_j;
+			}
+			advance = g->advance.x + Base::glyphKerning(prev, glyph).x + text_spacing;
+		}
+		if (c == ' ')
+		{
+			last_space = i;
+		}
+		line_width += advance;
+		prev = glyph;
+	}
+	lines.push_back(line.substr(start));
+}
+
+template <typename renderer_type>
+void BasicConsoleText<renderer_type>::layoutSlots()
+{
+	text_border.x = std::max<FT_Pos>(3 << 6, (text_size >> 3) >> 6 << 6);
+	text_border.y = 0;
+	slot_rows = std::max<int>(1, static_cast<int>((text_size + text_interline + 63) >> 6));
+	column_slots = std::max<size_t>(1, max_column_rows / slot_rows);
+	size_t columns = (max_lines + column_slots - 1) / column_slots;
+	texture.tex_w = console_width * static_cast<int>(columns);
+	texture.tex_h = slot_rows * static_cast<int>(std::min(max_lines, column_slots));
+}
+
+template <typename renderer_type>
+void BasicConsoleText<renderer_type>::slotPosition(size_t slot, int& x, int& y) const
+{
+	x = console_width * static_cast<int>(slot / column_slots);
+	y = slot_rows * static_cast<int>(slot % column_slots);
+}
+
+template <typename renderer_type>
+void BasicConsoleText<renderer_type>::rebuildTexture()
+{
+	countStage(TextStage::Raster);
+	layoutSlots();
+	TexelVector buffer(texture.tex_w, texture.tex_h, { 0, 0, 0, 0 });
+	ScopedStatTimer timer(Stat::CompositeNs);
+	Statistics::instance().add(Stat::CompositeCount);
+	FT_Pos baseline = font->getAscender();
+	for (size_t i = 0; i < ring_count; ++i)
+	{
+		size_t slot = (ring_head + i) % max_lines;
+		int x, y;
+		slotPosition(slot, x, y);
+		TexelVector line_buffer(console_width, slot_rows, { 0, 0, 0, 0 });
+		Base::compositeLine(line_buffer, ring[slot], text_border.x, baseline);
+		for (int r = 0; r < slot_rows; ++r)
+		{
+			std::copy_n(&line_buffer.at(0, r), console_width, &buffer.at(x, y + r));
+		}
+	}
+	Base::uploadText(buffer);
+	rebuild = false;
+}
+
+template <typename renderer_type>
+void BasicConsoleText<renderer_type>::makeText()
+{
+	std::lock_guard<std::mutex> lck(console_mutex);
+	TraceSpan span("ConsoleText::makeText");
+
+	std::vector<ConsoleOp> ops;
+	std::shared_ptr<TrueTypeFont> new_font;
+	std::unique_ptr<std::vector<std::string>> new_fallback;
+	{
+		std::lock_guard<std::mutex> pending_lck(pending_mutex);
+		ops.swap(pending_ops);
+		new_font.swap(pending_font);
+		new_fallback.swap(pending_fallback);
+	}
+	if (new_fallback)
+	{
+		Base::assignFallbackFonts(std::move(*new_fallback));
+		rebuild = true;
+	}
+	if (new_font && new_font.get() != font.get())
+	{
+		// rewrapping is not possible for lines already in the ring,
+		// they keep their breaks and only get composited again
+		Base::setFont(new_font);
+		rebuild = true;
+	}
+	if (font == nullptr) return;
+
+	if (texture.tex_id && !renderer_type::isTextureResident(texture.tex_id))
+	{
+		rebuild = true;
+	}
+	if (texture.tex_id == 0)
+	{
+		rebuild = true;
+	}
+
+	// play the operations on counters first, lines that would be pushed
+	// out of the ring again within this batch are never composited
+	std::deque<StringType> fresh;
+	size_t drop = 0;
+	if (!ops.empty())
+	{
+		countStage(TextStage::Decode);
+		countStage(TextStage::Wrap);
+		ScopedStatTimer timer(Stat::LayoutNs);
+		if (rebuild)
+		{
+			layoutSlots();
+		}
+		std::vector<StringType> wrapped;
+		for (auto&& op : ops)
+		{
+			switch (op.kind)
+			{
+			case ConsoleOpKind::Clear:
+				drop = ring_count;
+				fresh.clear();
+				break;
+			case ConsoleOpKind::Trim:
+			{
+				size_t lines = op.lines;
+				size_t k = std::min(lines, ring_count - drop);
+				drop += k;
+				lines -= k;
+				fresh.erase(fresh.begin(), fresh.begin() + std::min(lines, fresh.size()));
+				break;
+			}
+			case ConsoleOpKind::Append:
+			{
+				StringType text = op.text_u8.empty() ? std::move(op.text) : u8_to_u32(op.text_u8);
+				if (!text.empty() && text.back() == '\n')
+				{
+					text.pop_back();
+				}
+				StringValueType newline{ '\n' };
+				for (auto&& line : Base::split(text, newline))
+				{
+					wrapped.clear();
+					wrapLine(line, wrapped);
+					for (auto&& w : wrapped)
+					{
+						fresh.push_back(std::move(w));
+						if (ring_count - drop + fresh.size() > max_lines)
+						{
+							if (ring_count > drop)
+								drop++;
+							else
+								fresh.pop_front();
+						}
+					}
+				}
+				break;
+			}
+			}
+		}
+	}
+
+	for (size_t i = 0; i < drop; ++i)
+	{
+		StringType().swap(ring[ring_head]);
+		ring_head = (ring_head + 1) % max_lines;
+		ring_count--;
+	}
+	std::vector<size_t> new_slots;
+	for (auto&& line : fresh)
+	{
+		size_t slot = (ring_head + ring_count) % max_lines;
+		ring[slot] = std::move(line);
+		ring_count++;
+		new_slots.push_back(slot);
+	}
+
+	text_width = static_cast<FT_Pos>(console_width) << 6;
+	text_height = static_cast<FT_Pos>(slot_rows * ring_count) << 6;
+
+	if (!rebuild && !new_slots.empty())
+	{
+		countStage(TextStage::Raster);
+		FT_Pos baseline = font->getAscender();
+		for (auto slot : new_slots)
+		{
+			int x, y;
+			slotPosition(slot, x, y);
+			TexelVector buffer(console_width, slot_rows, { 0, 0, 0, 0 });
+			{
+				ScopedStatTimer timer(Stat::CompositeNs);
+				Statistics::instance().add(Stat::CompositeCount);
+				Base::compositeLine(buffer, ring[slot], text_border.x, baseline);
+			}
+			if (!Base::uploadTextRegion(texture, buffer, x, y))
+			{
+				rebuild = true;
+				break;
+			}
+		}
+	}
+	if (rebuild)
+	{
+		rebuildTexture();
+	}
+}
+
+template <typename renderer_type>
+void BasicConsoleText<renderer_type>::drawText(int x, int y)
+{
+	this->makeText();
+	std::lock_guard<std::mutex> lck(console_mutex);
+	if (texture.tex_id == 0 || texture.tex_w == 0 || texture.tex_h == 0)
+		return;
+
+	// oldest line on top, one quad per run of slots that are adjacent in the texture
+	auto c = text_color;
+	size_t i = 0;
+	while (i < ring_count)
+	{
+		size_t slot = (ring_head + i) % max_lines;
+		size_t run = 1;
+		while (i + run < ring_count)
+		{
+			size_t next = (slot + run) % max_lines;
+			if (next != slot + run || next / column_slots != slot / column_slots)
+				break;
+			run++;
+		}
+
+		int sx, sy;
+		slotPosition(slot, sx, sy);
+		int rows = slot_rows * static_cast<int>(run);
+		GLfloat u0 = static_cast<GLfloat>(sx) / texture.tex_w * texture.tex_u;
+		GLfloat v0 = static_cast<GLfloat>(sy) / texture.tex_h * texture.tex_v;
+		GLfloat uw = static_cast<GLfloat>(console_width) / texture.tex_w * texture.tex_u;
+		GLfloat vh = static_cast<GLfloat>(rows) / texture.tex_h * texture.tex_v;
+		Base::drawClipped(texture.tex_id, { x, y + slot_rows * static_cast<int>(i), console_width, rows },
+			{ c.r, c.g, c.b, c.a }, { u0, v0, uw, vh });
+		i += run;
+	}
+}
+
+template <typename renderer_type>
+typename BasicConsoleText<renderer_type>::Rect BasicConsoleText<renderer_type>::getTextRect(int x, int y)
+{
+	std::lock_guard<std::mutex> lck(console_mutex);
+	return { x, y, console_width, slot_rows * static_cast<int>(ring_count) };
+}
+
+template <typename renderer_type>
+void BasicConsoleText<renderer_type>::drawAll(int x, int y)
+{
+	drawText(x, y);
+}
+
+
+template class BasicConsoleText<BaseTextRendererGL2>;
+template class BasicConsoleText<BaseTextRendererNull>;
@@ -0,0 +1,121 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "BaseText.h"
+
+
+// Append-only text, e.g. an operator console streaming log lines.
+// Display lines are kept in a bounded ring, each one owns a slot of a
+// ring-organized texture and is laid out and composited by itself, so
+// appending costs only the new text and old lines drop off the top
+// without touching the rest.
+template <typename renderer_type = BaseTextRendererGL2>
+class BasicConsoleText : public BaseText<std::u32string, renderer_type>
+{
+private:
+	typedef BaseText<std::u32string, renderer_type> Base;
+
+public:
+	using typename Base::StringType;
+	using typename Base::StringValueType;
+	using typename Base::TextStage;
+	using typename Base::TextGlyph;
+	using typename Base::Rect;
+
+protected:
+	using Base::font;
+	using Base::text_size;
+	using Base::text_spacing;
+	using Base::text_interline;
+	using Base::text_color;
+	using Base::text_border;
+	using Base::text_width;
+	using Base::text_height;
+	using Base::texture;
+	using Base::countStage;
+
+public:
+	using Base::u8_to_u32;
+	using Base::to_u32string;
+
+private:
+	enum class ConsoleOpKind
+	{
+		Append,
+		Trim,
+		Clear,
+	};
+
+	// recorded by producer threads, applied in order by the render thread
+	struct ConsoleOp
+	{
+		ConsoleOpKind kind;
+		std::string text_u8;
+		StringType text;
+		size_t lines{ 0 };
+	};
+
+private:
+	// slots are stacked in columns, so long rings stay within texture limits
+	static constexpr int max_column_rows = 4096;
+
+private:
+	std::mutex pending_mutex;
+	std::vector<ConsoleOp> pending_ops;
+	std::shared_ptr<TrueTypeFont> pending_font;
+	std::unique_ptr<std::vector<std::string>> pending_fallback;
+
+private:
+	mutable std::mutex console_mutex;
+	std::vector<StringType> ring;
+	size_t ring_head{ 0 };
+	size_t ring_count{ 0 };
+	size_t max_lines{ 0 };
+	int console_width{ 0 };
+	int slot_rows{ 1 };
+	size_t column_slots{ 1 };
+	bool rebuild{ true };
+
+public:
+	BasicConsoleText(std::string font_name, int font_size, int width, size_t max_lines);
+	BasicConsoleText(std::shared_ptr<TrueTypeFont> font_ptr, int width, size_t max_lines);
+
+public:
+	// text may hold several lines, a trailing newline does not start an empty one
+	void append(std::string text);
+	void append(StringType text);
+	// drops the oldest display lines
+	void trim(size_t lines);
+	void clear();
+
+public:
+	void setFont(std::shared_ptr<TrueTypeFont> font_ptr) override;
+	void setFont(std::string font_name, int font_size) override;
+	void setFontSize(int font_size) override;
+	void setFallbackFonts(std::vector<std::string> font_names) override;
+
+public:
+	size_t getLineCount() const;
+	size_t getMaxLines() const;
+	std::vector<StringType> getLines() const override;
+
+public:
+	void makeText() override;
+	void drawText(int x, int y) override;
+	void drawAll(int x, int y) override;
+	Rect getTextRect(int x, int y) override;
+
+private:
+	void pushOp(ConsoleOp op);
+	void wrapLine(const StringType& line, std::vector<StringType>& lines);
+	void layoutSlots();
+	void slotPosition(size_t slot, int& x, int& y) const;
+	void rebuildTexture();
+
+};
+
+typedef BasicConsoleText<BaseTextRendererGL2> ConsoleText;
@@ -22,6 +22,7 @@ FontRepository& FontRepository::instance()
 
 std::shared_ptr<TrueTypeFont> FontRepository::getFont(std::string font_name, size_t size)
 {
+	std::lock_guard<std::mutex> lck(repository_mutex);
 	if (fonts.count(font_name))
 	{
 		if (fonts[font_name].count(size))
@@ -30,6 +31,17 @@ std::shared_ptr<TrueTypeFont> FontRepository::getFont(std::string font_name, siz
 		}
 	}
 
+	auto font = openFont(font_name, size);
+	if (font == nullptr)
+	{
+		throw std::runtime_error("missing font: "s + font_name + "(.ttf|.ttc|.otf)\n"s);
+	}
+	fonts[font_name][size] = font;
+	return font;
+}
+
+std::shared_ptr<TrueTypeFont> FontRepository::openFont(const std::string& font_name, size_t size)
+{
 	FT_Face face;
 	std::initializer_list<std::string> font_locations{ "fonts/", "./" };
 	std::initializer_list<std::string> font_extensions{ ".ttf", ".ttc", ".otf", "" };
@@ -40,11 +52,59 @@ std::shared_ptr<TrueTypeFont> FontRepository::getFont(std::string font_name, siz
 			if (FT_New_Face(ft, (location + font_name + extension).c_str(), 0, &face) == 0)
 			{
 				FT_Set_Pixel_Sizes(face, 0, size);
-				fonts[font_name][size] = std::make_shared<TrueTypeFont>(face, font_name);
-				return fonts[font_name][size];
+				auto&& coverage = coverages[font_name];
+				auto font = std::make_shared<TrueTypeFont>(face, font_name, coverage);
+				coverage = font->getCoverage();
+				return font;
 			}
 		}
 	}
+	return nullptr;
+}
 
-	throw std::runtime_error("missing font: "s + font_name + "(.ttf|.ttc|.otf)\n"s);
+void FontRepository::addBakedFont(const BakedFont& baked)
+{
+	std::lock_guard<std::mutex> lck(repository_mutex);
+	std::string font_name = baked.name;
+	size_t size = baked.metrics.y_ppem;
+	fonts[font_name][size] = std::make_shared<TrueTypeFont>(baked, [this, font_name, size]
+	{
+		std::lock_guard<std::mutex> lck(repository_mutex);
+		return openFont(font_name, size);
+	});
+}
+
+Statistics::Snapshot FontRepository::getStatistics() const
+{
+	return Statistics::instance().getSnapshot();
+}
+
+void FontRepository::resetStatistics()
+{
+	Statistics::instance().reset();
+}
+
+void FontRepository::setTracing(bool enabled)
+{
+	Statistics::instance().setTracing(enabled);
+}
+
+void FontRepository::exportTrace(std::ostream& os) const
+{
+	Statistics::instance().exportTrace(os);
+}
+
+void FontRepository::setMemoryResource(MemoryResource* resource)
+{
+	Memory::instance().setResource(resource);
+}
+
+Memory::Snapshot FontRepository::getMemoryStatistics() const
+{
+	return Memory::instance().getSnapshot();
+}
+
+void FontRepository::resetMemoryStatistics()
+{
+	Memory::instance().reset();
 }
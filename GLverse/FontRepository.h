@@ -1,18 +1,27 @@
 #pragma once
 #include <memory>
+#include <mutex>
+#include <ostream>
 #include <string>
 #include <unordered_map>
 #include <ft2build.h>
 #include FT_FREETYPE_H
 
+#include "MemoryResource.h"
+#include "Statistics.h"
 #include "TrueTypeFont.h"
 
 
 class FontRepository
 {
+private:
+	std::mutex repository_mutex;
+
 private:
 	FT_Library ft;
 	std::unordered_map<std::string, std::unordered_map<size_t, std::shared_ptr<TrueTypeFont>>> fonts;
+	// cmap coverage by font name, every size of a face shares it
+	std::unordered_map<std::string, TrueTypeCoveragePtr> coverages;
 
 private:
 	FontRepository();
@@ -23,5 +32,24 @@ public:
 
 public:
 	std::shared_ptr<TrueTypeFont> getFont(std::string font_name, size_t size);
+	// getFont(name, size) serves the baked font from now on; the font file is
+	// opened only once a character outside of the baked charset is asked for
+	void addBakedFont(const BakedFont& baked);
+
+private:
+	// repository_mutex held, nullptr when there is no such file
+	std::shared_ptr<TrueTypeFont> openFont(const std::string& font_name, size_t size);
+
+public:
+	Statistics::Snapshot getStatistics() const;
+	void resetStatistics();
+	void setTracing(bool enabled);
+	void exportTrace(std::ostream& os) const;
+
+public:
+	// one resource for glyph, coverage, texel and line table storage, see MemoryResource
+	void setMemoryResource(MemoryResource* resource);
+	Memory::Snapshot getMemoryStatistics() const;
+	void resetMemoryStatistics();
 
 };
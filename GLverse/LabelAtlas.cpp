@@ -0,0 +1,271 @@
+#include "LabelAtlas.h"
+#include "BaseTextRendererGL2.h"
+#include "BaseTextRendererNull.h"
+#include "Statistics.h"
+#include <algorithm>
+
+
+template <typename renderer_type>
+constexpr uint32_t LabelAtlas<renderer_type>::NoPage;
+
+template <typename renderer_type>
+LabelAtlas<renderer_type>::LabelAtlas(int page_size):
+	page_size{ std::max(page_size, 64) }
+{
+}
+
+template <typename renderer_type>
+LabelAtlas<renderer_type>::~LabelAtlas()
+{
+	for (auto&& page : pages)
+	{
+		renderer_type::deleteTexture(page.texture.tex_id);
+	}
+}
+
+template <typename renderer_type>
+int LabelAtlas<renderer_type>::getPageSize() const
+{
+	return page_size;
+}
+
+template <typename renderer_type>
+bool LabelAtlas<renderer_type>::fits(int w, int h) const
+{
+	return w > 0 && h > 0 && w <= page_size / 4 && h <= page_size / 4;
+}
+
+template <typename renderer_type>
+typename LabelAtlas<renderer_type>::Usage LabelAtlas<renderer_type>::getUsage() const
+{
+	Usage usage;
+	for (auto&& page : pages)
+	{
+		if (page.texture.tex_id != 0)
+			usage.pages++;
+		usage.regions += page.regions;
+		usage.used_area += page.used_area;
+	}
+	usage.page_area = static_cast<uint64_t>(page_size) * page_size * usage.pages;
+	return usage;
+}
+
+template <typename renderer_type>
+uint32_t LabelAtlas<renderer_type>::getPageCount() const
+{
+	return static_cast<uint32_t>(pages.size());
+}
+
+template <typename renderer_type>
+bool LabelAtlas<renderer_type>::allocate(int w, int h, Region& region)
+{
+	region = Region{};
+	if (!fits(w, h))
+		return false;
+
+	// a texel of gap to the right and below, shelves are 8 texels apart in height
+	int aw = w + 1;
+	int ah = h + 1;
+	int sh = (ah + 7) & ~7;
+	auto place = [&](uint32_t p)
+	{
+		auto&& page = pages[p];
+		if (page.texture.tex_id == 0)
+		{
+			createStorage(page);
+		}
+		for (auto&& shelf : page.shelves)
+		{
+			// not much taller than needed, or the shelf is mostly wasted
+			if (shelf.h < ah || shelf.h > sh + sh / 2)
+				continue;
+			for (auto span = shelf.free.begin(); span != shelf.free.end(); ++span)
+			{
+				if (span->w < aw)
+					continue;
+				region = { p, span->x, shelf.y, w, h };
+				span->x += aw;
+				span->w -= aw;
+				if (span->w == 0)
+					shelf.free.erase(span);
+				return true;
+			}
+		}
+		if (page.top + sh > page_size)
+			return false;
+
+		page.shelves.push_back({ page.top, sh, {} });
+		if (page_size > aw)
+			page.shelves.back().free.push_back({ aw, page_size - aw });
+		region = { p, 0, page.top, w, h };
+		page.top += sh;
+		return true;
+	};
+
+	bool placed = false;
+	for (uint32_t p = 0; p < pages.size() && !placed; ++p)
+	{
+		placed = place(p);
+	}
+	if (!placed)
+	{
+		pages.emplace_back();
+		placed = place(static_cast<uint32_t>(pages.size() - 1));
+	}
+	if (placed)
+	{
+		auto&& page = pages[region.page];
+		page.regions++;
+		page.used_area += static_cast<uint64_t>(w) * h;
+	}
+	return placed;
+}
+
+template <typename renderer_type>
+void LabelAtlas<renderer_type>::release(Region& region)
+{
+	if (region.page >= pages.size())
+	{
+		region = Region{};
+		return;
+	}
+
+	auto&& page = pages[region.page];
+	auto shelf = std::find_if(page.shelves.begin(), page.shelves.end(), [&](const Shelf& s) { return s.y == region.y; });
+	if (shelf != page.shelves.end())
+	{
+		// back into the free spans, merged with its neighbours
+		auto&& free = shelf->free;
+		Span span{ region.x, std::min(region.w + 1, page_size - region.x) };
+		auto next = std::lower_bound(free.begin(), free.end(), span, [](const Span& a, const Span& b) { return a.x < b.x; });
+		next = free.insert(next, span);
+		if (next + 1 != free.end() && next->x + next->w == (next + 1)->x)
+		{
+			next->w += (next + 1)->w;
+			free.erase(next + 1);
+		}
+		if (next != free.begin() && (next - 1)->x + (next - 1)->w == next->x)
+		{
+			(next - 1)->w += next->w;
+			free.erase(next);
+		}
+		page.regions--;
+		page.used_area -= static_cast<uint64_t>(region.w) * region.h;
+
+		// empty shelves on top are given back, for regions of any height
+		while (!page.shelves.empty())
+		{
+			auto&& last = page.shelves.back();
+			if (last.free.size() != 1 || last.free.front().x != 0 || last.free.front().w != page_size)
+				break;
+			page.top = last.y;
+			page.shelves.pop_back();
+		}
+	}
+	region = Region{};
+}
+
+template <typename renderer_type>
+bool LabelAtlas<renderer_type>::upload(const Region& region, const TexelVector& buffer)
+{
+	auto&& page = pages[region.page];
+	ScopedStatTimer timer(Stat::UploadNs);
+	Statistics::instance().add(Stat::UploadCount);
+	Statistics::instance().add(Stat::UploadBytes, buffer.size() * sizeof(TVE::BGRATexel));
+	if (renderer_type::uploadTextureRegion(page.texture, buffer, region.x, region.y))
+		return true;
+
+	createStorage(page);
+	renderer_type::uploadTextureRegion(page.texture, buffer, region.x, region.y);
+	return false;
+}
+
+template <typename renderer_type>
+GLuint LabelAtlas<renderer_type>::getTexture(uint32_t page) const
+{
+	return page < pages.size() ? pages[page].texture.tex_id : 0;
+}
+
+template <typename renderer_type>
+typename LabelAtlas<renderer_type>::Rect LabelAtlas<renderer_type>::getUV(const Region& region) const
+{
+	auto&& texture = pages[region.page].texture;
+	GLfloat su = texture.tex_u / page_size;
+	GLfloat sv = texture.tex_v / page_size;
+	return { region.x * su, region.y * sv, region.w * su, region.h * sv };
+}
+
+template <typename renderer_type>
+bool LabelAtlas<renderer_type>::isResident(uint32_t page) const
+{
+	// an empty page has nothing to lose
+	return page < pages.size() && (pages[page].regions == 0 || renderer_type::isTextureResident(pages[page].texture.tex_id));
+}
+
+template <typename renderer_type>
+void LabelAtlas<renderer_type>::restore(uint32_t page)
+{
+	if (page < pages.size())
+	{
+		createStorage(pages[page]);
+	}
+}
+
+template <typename renderer_type>
+std::vector<uint32_t> LabelAtlas<renderer_type>::getFragmentedPages() const
+{
+	std::vector<uint32_t> fragmented;
+	for (uint32_t p = 0; p < pages.size(); ++p)
+	{
+		auto&& page = pages[p];
+		uint64_t shelf_area = static_cast<uint64_t>(page.top) * page_size;
+		if (page.top > page_size / 2 && page.used_area * 2 < shelf_area)
+			fragmented.push_back(p);
+	}
+	std::stable_sort(fragmented.begin(), fragmented.end(), [this](uint32_t a, uint32_t b) { return pages[a].used_area < pages[b].used_area; });
+	return fragmented;
+}
+
+template <typename renderer_type>
+void LabelAtlas<renderer_type>::reset(uint32_t page)
+{
+	if (page >= pages.size())
+		return;
+
+	auto&& p = pages[page];
+	p.shelves.clear();
+	p.top = 0;
+	p.regions = 0;
+	p.used_area = 0;
+}
+
+template <typename renderer_type>
+void LabelAtlas<renderer_type>::trim()
+{
+	// pages are only removed from the back, the others keep their index
+	while (!pages.empty() && pages.back().regions == 0)
+	{
+		renderer_type::deleteTexture(pages.back().texture.tex_id);
+		pages.pop_back();
+	}
+	for (auto&& page : pages)
+	{
+		if (page.regions == 0)
+			renderer_type::deleteTexture(page.texture.tex_id);
+	}
+}
+
+template <typename renderer_type>
+void LabelAtlas<renderer_type>::createStorage(Page& page)
+{
+	TexelVector blank(page_size, page_size, { 0, 0, 0, 0 });
+	page.texture.tex_w = page_size;
+	page.texture.tex_h = page_size;
+	Statistics::instance().add(Stat::UploadCount);
+	Statistics::instance().add(Stat::UploadBytes, blank.size() * sizeof(TVE::BGRATexel));
+	renderer_type::uploadTexture(page.texture, blank);
+}
+
+
+template class LabelAtlas<BaseTextRendererGL2>;
+template class LabelAtlas<BaseTextRendererNull>;
@@ -0,0 +1,107 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "OpenGL.h"
+#include "TexelVector.h"
+
+
+// Shared pages for the composites of small labels, so that a screen of them
+// is drawn from a few textures instead of one texture each. Each page is
+// packed in shelves: regions go to the first shelf of about their height with
+// a free span wide enough, freed spans are merged and empty shelves on top are
+// given back. Pages that are mostly holes are reset by their owner, whose
+// labels are then packed again. Not thread safe, it belongs to its owner.
+template <typename renderer_type>
+class LabelAtlas
+{
+public:
+	typedef typename renderer_type::Rect Rect;
+
+	static constexpr uint32_t NoPage = 0xffffffff;
+
+	struct Region
+	{
+		uint32_t page{ NoPage };
+		int x{ 0 };
+		int y{ 0 };
+		int w{ 0 };
+		int h{ 0 };
+	};
+
+	struct Usage
+	{
+		size_t pages{ 0 };
+		size_t regions{ 0 };
+		uint64_t used_area{ 0 }; // texels of live regions
+		uint64_t page_area{ 0 };
+	};
+
+private:
+	struct Span
+	{
+		int x;
+		int w;
+	};
+
+	struct Shelf
+	{
+		int y;
+		int h;
+		std::vector<Span> free; // sorted by x
+	};
+
+	struct Page
+	{
+		GLtexture texture{};
+		std::vector<Shelf> shelves; // sorted by y
+		int top{ 0 }; // below the last shelf
+		size_t regions{ 0 };
+		uint64_t used_area{ 0 };
+	};
+
+private:
+	int page_size;
+	std::vector<Page> pages;
+
+public:
+	explicit LabelAtlas(int page_size = 1024);
+	~LabelAtlas();
+	LabelAtlas(const LabelAtlas&) = delete;
+	LabelAtlas& operator=(const LabelAtlas&) = delete;
+
+public:
+	int getPageSize() const;
+	// regions larger than this in either direction are not worth packing
+	bool fits(int w, int h) const;
+	// pages with storage only
+	Usage getUsage() const;
+	// page indices are below this
+	uint32_t getPageCount() const;
+
+public:
+	// false (and no region) when it does not fit a page
+	bool allocate(int w, int h, Region& region);
+	void release(Region& region);
+	// false when the storage of the page was evicted: it is allocated again,
+	// blank, and every other region of the page has to be uploaded again
+	bool upload(const Region& region, const TexelVector& buffer);
+
+public:
+	GLuint getTexture(uint32_t page) const;
+	// texture coordinates of the region within its page, for drawTexture
+	Rect getUV(const Region& region) const;
+	bool isResident(uint32_t page) const;
+	// allocates evicted storage again, blank; its regions are kept
+	void restore(uint32_t page);
+	// pages with more holes than regions once they are half full, emptiest first
+	std::vector<uint32_t> getFragmentedPages() const;
+	// forgets every region of the page, their owners allocate them again
+	void reset(uint32_t page);
+	// frees the storage of empty pages, they are allocated again when needed
+	void trim();
+
+private:
+	void createStorage(Page& page);
+
+};
@@ -1,133 +1,975 @@
 #include "LazyText.h"
+#include "BaseTextRendererNull.h"
+#include "TextWorkerPool.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
 #include <unordered_set>
 
 
-LazyText::LazyText(std::string font_name, int font_size):
-	BaseText(font_name, font_size)
+template <typename renderer_type>
+BasicLazyText<renderer_type>::BasicLazyText(std::string font_name, int font_size):
+	Base(font_name, font_size)
 {
+	auto state = std::make_shared<TextState>();
+	state->text = std::make_shared<const StringType>();
+	state->font = font;
+	pending_state = state;
 }
 
-LazyText::LazyText(std::shared_ptr<TrueTypeFont> font_ptr):
-	BaseText(font_ptr)
+template <typename renderer_type>
+BasicLazyText<renderer_type>::BasicLazyText(std::shared_ptr<TrueTypeFont> font_ptr):
+	Base(font_ptr)
 {
+	auto state = std::make_shared<TextState>();
+	state->text = std::make_shared<const StringType>();
+	state->font = font;
+	pending_state = state;
 }
 
-void LazyText::setText(StringType new_text)
+template <typename renderer_type>
+BasicLazyText<renderer_type>::~BasicLazyText()
 {
-	std::lock_guard<std::mutex> lck(lazy_mutex);
-	if (needs_rebreaking || (attempt_to_break && new_text != unbroken_text))
+	if (prepare_job.valid())
+	{
+		prepare_job.wait();
+	}
+	releaseTiles();
+	releaseTexture();
+}
+
+template <typename renderer_type>
+template <typename F>
+void BasicLazyText<renderer_type>::publishState(F&& update)
+{
+	// copy-on-write: producers never touch the state the renderer is using,
+	// concurrent producers simply retry on top of each other's updates
+	auto old_state = std::atomic_load(&pending_state);
+	std::shared_ptr<const TextState> new_state;
+	do {
+		auto state = std::make_shared<TextState>(*old_state);
+		update(*state);
+		new_state = state;
+	} while (!std::atomic_compare_exchange_weak(&pending_state, &old_state, new_state));
+	pending_version.fetch_add(1, std::memory_order_release);
+}
+
+template <typename renderer_type>
+bool BasicLazyText<renderer_type>::consumeState()
+{
+	auto version = pending_version.load(std::memory_order_acquire);
+	if (version == consumed_version)
+	{
+		return false;
+	}
+	// updates published since the last build are coalesced into the newest state,
+	// which counts as consumed only once all of it has been applied
+	auto state = std::atomic_load(&pending_state);
+	applyState(*state);
+	consumed_version = version;
+	return true;
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::applyState(const TextState& state)
+{
+	if (state.text != source_text || state.text_u8 != source_text_u8)
+	{
+		source_text = state.text;
+		source_text_u8 = state.text_u8;
+		markDirty(TextStage::Decode);
+	}
+	if (state.styled != source_styled)
+	{
+		// styles change the measure even when the characters stay the same
+		source_styled = state.styled;
+		if (source_styled)
+			Base::setStyles(source_styled->styles, source_styled->char_styles);
+		else
+			Base::setStyles({}, {});
+		markDirty(TextStage::Decode);
+		markDirty(TextStage::Wrap);
+		markDirty(TextStage::Measure);
+	}
+	if (state.font && state.font.get() != font.get())
 	{
-		unbroken_text = new_text;
-		new_text = this->fitText(new_text);
-		text_changed = true;
+		Base::setFont(state.font);
+		markDirty(TextStage::Wrap);
+		markDirty(TextStage::Measure);
 	}
-	else if (!attempt_to_break && text != new_text)
+	if (state.fallback_names != fallback_names)
 	{
-		text_changed = true;
+		// checked by setFallbackFonts already, a font gone since is skipped
+		Base::assignFallbackFonts(state.fallback_names);
+		markDirty(TextStage::Wrap);
+		markDirty(TextStage::Measure);
 	}
-	BaseText::setText(new_text);
-	BaseText::prepareText();
+	if (state.effects != text_effects)
+	{
+		// effects grow the texture border, but leave the measure alone
+		Base::setEffects(state.effects);
+		markDirty(TextStage::Raster);
+	}
+	if (state.spacing != text_spacing)
+	{
+		text_spacing = state.spacing;
+		markDirty(TextStage::Wrap);
+		markDirty(TextStage::Measure);
+	}
+	if (state.interline != text_interline)
+	{
+		text_interline = state.interline;
+		markDirty(TextStage::Measure);
+	}
+	if (state.align != text_align)
+	{
+		text_align = state.align;
+		markDirty(TextStage::Raster);
+	}
+	if (state.attempt_to_break != attempt_to_break || state.max_line_length != max_line_length)
+	{
+		attempt_to_break = state.attempt_to_break;
+		max_line_length = state.max_line_length;
+		markDirty(TextStage::Wrap);
+	}
+	if (state.viewport != viewport || state.tile_rows != tile_rows)
+	{
+		viewport = state.viewport;
+		tile_rows = state.tile_rows;
+		markDirty(TextStage::Raster);
+	}
+	applyScroll(state);
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::applyScroll(const TextState& state)
+{
+	// scrolling alone invalidates nothing, it only selects other tiles
+	viewport_top = state.viewport_top;
+	viewport_rows = state.viewport_rows;
+	viewport_prefetch = state.viewport_prefetch;
+	max_tiles = state.max_tiles;
+}
+
+template <typename renderer_type>
+bool BasicLazyText<renderer_type>::isScrollOnly(const TextState& from, const TextState& to)
+{
+	return from.text_u8 == to.text_u8
+		&& from.text == to.text
+		&& from.styled == to.styled
+		&& from.font == to.font
+		&& from.fallback_names == to.fallback_names
+		&& from.effects == to.effects
+		&& from.spacing == to.spacing
+		&& from.interline == to.interline
+		&& from.align == to.align
+		&& from.max_line_length == to.max_line_length
+		&& from.attempt_to_break == to.attempt_to_break
+		&& from.viewport == to.viewport
+		&& from.tile_rows == to.tile_rows;
 }
 
-void LazyText::setText(std::string new_text)
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::markDirty(TextStage stage)
 {
-	setText(u8_to_u32(new_text));
+	dirty_stages |= 1u << static_cast<unsigned>(stage);
 }
 
-void LazyText::setText(std::u16string new_text)
+template <typename renderer_type>
+bool BasicLazyText<renderer_type>::isDirty(TextStage stage) const
+{
+	return dirty_stages & (1u << static_cast<unsigned>(stage));
+}
+
+template <typename renderer_type>
+bool BasicLazyText<renderer_type>::decodeText()
+{
+	countStage(TextStage::Decode);
+	ScopedStatTimer timer(Stat::LayoutNs);
+	StringType decoded_text;
+	if (source_styled)
+	{
+		decoded_text = source_styled->text;
+	}
+	else if (source_text_u8)
+	{
+		decoded_text = u8_to_u32(*source_text_u8);
+	}
+	else if (source_text)
+	{
+		decoded_text = *source_text;
+	}
+	if (decoded_text == unbroken_text)
+	{
+		return false;
+	}
+	unbroken_text = std::move(decoded_text);
+	return true;
+}
+
+template <typename renderer_type>
+bool BasicLazyText<renderer_type>::wrapText()
+{
+	countStage(TextStage::Wrap);
+	ScopedStatTimer timer(Stat::LayoutNs);
+	auto new_text = attempt_to_break ? this->fitText(unbroken_text) : unbroken_text;
+	if (new_text == text)
+	{
+		return false;
+	}
+	Base::setText(std::move(new_text));
+	return true;
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::setText(StringType new_text)
+{
+	auto shared_text = std::make_shared<const StringType>(std::move(new_text));
+	publishState([&](TextState& state)
+	{
+		state.text = shared_text;
+		state.text_u8 = nullptr;
+		state.styled = nullptr;
+	});
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::setText(std::string new_text)
+{
+	// decoding is deferred to the render thread
+	auto shared_text = std::make_shared<const std::string>(std::move(new_text));
+	publishState([&](TextState& state)
+	{
+		state.text = nullptr;
+		state.text_u8 = shared_text;
+		state.styled = nullptr;
+	});
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::setText(std::u16string new_text)
 {
 	setText(to_u32string(new_text));
 }
 
-void LazyText::setText(std::wstring new_text)
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::setText(std::wstring new_text)
 {
 	setText(to_u32string(new_text));
 }
 
-void LazyText::setFontSize(int font_size)
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::setStyledText(const std::vector<TextRun>& runs)
+{
+	// characters keep 16-bit style indices
+	if (runs.size() > size_t{ std::numeric_limits<uint16_t>::max() } + 1)
+	{
+		throw std::length_error("styled text: more than 65536 runs\n");
+	}
+
+	auto text_font = std::atomic_load(&pending_state)->font;
+	auto styled = std::make_shared<StyledText>();
+	for (auto&& run : runs)
+	{
+		TextStyle style;
+		if (!run.font_name.empty() || run.font_size != 0)
+		{
+			auto font_name = run.font_name.empty() ? text_font->getFontName() : run.font_name;
+			auto font_size = run.font_size != 0 ? run.font_size : static_cast<int>(text_font->getPixelSize());
+			style.font = FontRepository::instance().getFont(font_name, font_size);
+		}
+		auto channel = [](int v) { return static_cast<uint8_t>(std::min(std::max(v, 0), 255)); };
+		style.color.r = channel(run.r);
+		style.color.g = channel(run.g);
+		style.color.b = channel(run.b);
+		style.color.a = channel(run.a);
+		style.spacing = static_cast<FT_Pos>(std::floor(run.spacing * 64.0));
+
+		auto run_text = u8_to_u32(run.text);
+		styled->text += run_text;
+		styled->char_styles.insert(styled->char_styles.end(), run_text.size(), static_cast<uint16_t>(styled->styles.size()));
+		styled->styles.push_back(std::move(style));
+	}
+
+	std::shared_ptr<const StyledText> shared_styled = styled;
+	publishState([&](TextState& state)
+	{
+		state.text = nullptr;
+		state.text_u8 = nullptr;
+		state.styled = shared_styled;
+	});
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::setFontSize(int font_size)
+{
+	// the face of the state the size lands on, so a concurrent setFont is not undone
+	std::shared_ptr<TrueTypeFont> font_ptr;
+	publishState([&](TextState& state)
+	{
+		auto font_name = state.font->getFontName();
+		if (font_ptr == nullptr || font_ptr->getFontName() != font_name)
+			font_ptr = FontRepository::instance().getFont(font_name, font_size);
+		state.font = font_ptr;
+	});
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::setSpacing(float spacing)
+{
+	auto sp = static_cast<FT_Pos>(std::floor(spacing * 64.0));
+	publishState([&](TextState& state) { state.spacing = sp; });
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::setLineSpacing(float spacing)
+{
+	auto sp = static_cast<FT_Pos>(std::floor(spacing * 64.0));
+	publishState([&](TextState& state) { state.interline = sp; });
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::setMaxLineLength(float length)
+{
+	publishState([&](TextState& state)
+	{
+		state.attempt_to_break = true;
+		state.max_line_length = length;
+	});
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::setAlign(TextAlign align)
+{
+	publishState([&](TextState& state) { state.align = align; });
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::setFont(std::shared_ptr<TrueTypeFont> font_ptr)
+{
+	publishState([&](TextState& state) { state.font = font_ptr; });
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::setFallbackFonts(std::vector<std::string> font_names)
+{
+	// a missing font throws here, on the thread of the caller, not in drawText
+	Base::checkFallbackFonts(font_names, std::atomic_load(&pending_state)->font->getPixelSize());
+	publishState([&](TextState& state) { state.fallback_names = font_names; });
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::setEffects(std::vector<TextEffect> effects)
+{
+	publishState([&](TextState& state) { state.effects = effects; });
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::setFont(std::string font_name, int font_size)
+{
+	auto font_ptr = FontRepository::instance().getFont(font_name, font_size);
+	publishState([&](TextState& state) { state.font = font_ptr; });
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::setViewport(int top, int rows, int prefetch)
+{
+	publishState([&](TextState& state)
+	{
+		state.viewport = true;
+		state.viewport_top = std::max(0, top);
+		state.viewport_rows = std::max(0, rows);
+		state.viewport_prefetch = std::max(0, prefetch);
+	});
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::setTileCache(int tile_rows, size_t max_tiles)
+{
+	publishState([&](TextState& state)
+	{
+		state.tile_rows = std::max(1, tile_rows);
+		state.max_tiles = max_tiles;
+	});
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::clearViewport()
+{
+	publishState([&](TextState& state) { state.viewport = false; });
+}
+
+template <typename renderer_type>
+size_t BasicLazyText<renderer_type>::getTileCount() const
+{
+	return tiles.size();
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::setPrepareMode(PrepareMode mode)
+{
+	std::lock_guard<std::mutex> lck(lazy_mutex);
+	if (mode == prepare_mode)
+		return;
+
+	if (mode == PrepareMode::Inline)
+	{
+		if (prepare_job.valid())
+		{
+			prepare_job.wait();
+			finishJob();
+		}
+		worker_text.reset();
+	}
+	prepare_mode = mode;
+}
+
+template <typename renderer_type>
+typename BasicLazyText<renderer_type>::PrepareMode BasicLazyText<renderer_type>::getPrepareMode() const
+{
+	return prepare_mode;
+}
+
+template <typename renderer_type>
+bool BasicLazyText<renderer_type>::isReady()
+{
+	std::lock_guard<std::mutex> lck(lazy_mutex);
+	return !prepare_job.valid() && pending_version.load(std::memory_order_acquire) == consumed_version;
+}
+
+template <typename renderer_type>
+std::string BasicLazyText<renderer_type>::getPrepareError() const
+{
+	std::lock_guard<std::mutex> lck(lazy_mutex);
+	return prepare_error;
+}
+
+template <typename renderer_type>
+size_t BasicLazyText<renderer_type>::getStageRuns(TextStage stage) const
+{
+	return getStageRuns()[static_cast<size_t>(stage)];
+}
+
+template <typename renderer_type>
+typename BasicLazyText<renderer_type>::TextStageRuns BasicLazyText<renderer_type>::getStageRuns() const
 {
+	// stages prepared in the background are run by the twin, under its lock while a job runs
 	std::lock_guard<std::mutex> lck(lazy_mutex);
-	if (text_size != font_size)
+	auto runs = Base::getStageRuns();
+	if (worker_text)
+	{
+		std::lock_guard<std::mutex> worker_lck(worker_text->lazy_mutex);
+		auto worker_runs = worker_text->Base::getStageRuns();
+		for (size_t i = 0; i < runs.size(); ++i)
+			runs[i] += worker_runs[i];
+	}
+	return runs;
+}
+
+template <typename renderer_type>
+bool BasicLazyText<renderer_type>::runStages(TexelVector& buffer)
+{
+	consumeState();
+	if (font == nullptr) return false;
+
+	// each stage runs only when one of its inputs changed,
+	// and invalidates the next stage only when its output changed
+	if (isDirty(TextStage::Decode) && decodeText())
+	{
+		markDirty(TextStage::Wrap);
+	}
+	if (isDirty(TextStage::Wrap) && wrapText())
+	{
+		markDirty(TextStage::Split);
+	}
+	if (isDirty(TextStage::Split))
+	{
+		Base::splitText();
+		markDirty(TextStage::Measure);
+	}
+	if (isDirty(TextStage::Measure))
+	{
+		Base::measureText();
+		markDirty(TextStage::Raster);
+	}
+
+	// no GL here, tiles of the viewport mode are composited by publishTexture
+	bool rastered = isDirty(TextStage::Raster);
+	if (rastered && viewport)
+	{
+		Base::layoutTexture();
+	}
+	else if (rastered)
 	{
-		text_changed = true;
+		// a texture shared with an identical text is neither composited nor uploaded again;
+		// in a twin nothing is replaced here, finishJob takes every entry it acquires
+		next_shared_texture = acquireTexture();
+		if (next_shared_texture && TextureCache::instance().isReady(next_shared_texture))
+			Base::layoutTexture();
+		else
+			buffer = Base::rasterText();
 	}
-	BaseText::setFontSize(font_size);
-	BaseText::prepareText();
+	dirty_stages = 0;
+	return rastered;
 }
 
-void LazyText::setSpacing(float spacing)
+template <typename renderer_type>
+typename BasicLazyText<renderer_type>::TextureCache::EntryPtr BasicLazyText<renderer_type>::acquireTexture()
+{
+	auto&& cache = TextureCache::instance();
+	if (!cache.isEnabled())
+		return nullptr;
+
+	// everything the composite depends on, fonts by address
+	std::string key;
+	std::vector<std::shared_ptr<TrueTypeFont>> fonts{ font };
+	auto append = [&key](const auto& value)
+	{
+		key.append(reinterpret_cast<const char*>(&value), sizeof(value));
+	};
+	append(font.get());
+	append(Base::fallback_fonts.size());
+	for (auto&& fallback : Base::fallback_fonts)
+	{
+		append(fallback.get());
+		fonts.push_back(fallback);
+	}
+	append(text_effects.size());
+	for (auto&& effect : text_effects)
+	{
+		append(effect.kind);
+		append(effect.radius);
+		append(effect.offset_x);
+		append(effect.offset_y);
+		append(effect.color);
+	}
+	append(Base::text_styles.size());
+	for (auto&& style : Base::text_styles)
+	{
+		append(style.font.get());
+		append(style.color);
+		append(style.spacing);
+		if (style.font)
+			fonts.push_back(style.font);
+	}
+	key.append(reinterpret_cast<const char*>(Base::text_char_styles.data()), Base::text_char_styles.size() * sizeof(uint16_t));
+	append(text_spacing);
+	append(text_interline);
+	append(text_align);
+	append(text.size());
+	key.append(reinterpret_cast<const char*>(text.data()), text.size() * sizeof(StringValueType));
+	return cache.acquire(std::move(key), std::move(fonts));
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::publishTexture(bool rastered, TexelVector& buffer)
+{
+	if (viewport)
+	{
+		if (rastered)
+		{
+			releaseTexture();
+			releaseTiles();
+		}
+		updateTiles();
+	}
+	else if (rastered && next_shared_texture)
+	{
+		releaseTiles();
+		if (!shared_texture)
+			renderer_type::deleteTexture(texture.tex_id);
+		shared_texture = std::move(next_shared_texture);
+		auto&& cache = TextureCache::instance();
+		if (!cache.isReady(shared_texture))
+		{
+			// first user, or its storage was evicted since the raster stage
+			if (buffer.empty())
+				buffer = Base::rasterText();
+			cache.upload(shared_texture, [&](GLtexture& target)
+			{
+				target.tex_w = texture.tex_w;
+				target.tex_h = texture.tex_h;
+				Base::uploadText(target, buffer);
+			});
+		}
+		texture = cache.getTexture(shared_texture);
+		buffer = TexelVector(0, 0, {});
+	}
+	else if (rastered)
+	{
+		releaseTiles();
+		if (shared_texture)
+			releaseTexture();
+		Base::uploadText(buffer);
+		// the composite is not needed anymore, do not keep it around
+		buffer = TexelVector(0, 0, {});
+	}
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::releaseTexture()
+{
+	// a shared texture is deleted by the cache, once its last user lets go
+	if (shared_texture)
+	{
+		texture.tex_id = 0;
+		shared_texture.reset();
+	}
+	else
+	{
+		renderer_type::deleteTexture(texture.tex_id);
+	}
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::makeText()
 {
 	std::lock_guard<std::mutex> lck(lazy_mutex);
-	if (text_spacing != spacing)
+	TraceSpan span("LazyText::makeText");
+	if (prepare_mode != PrepareMode::Inline)
+	{
+		makeTextBackground();
+		return;
+	}
+
+	if (shared_texture)
+	{
+		// another user may have uploaded evicted storage again, under a new name
+		texture = TextureCache::instance().getTexture(shared_texture);
+	}
+	if (texture.tex_id && !renderer_type::isTextureResident(texture.tex_id))
+	{
+		// storage was evicted while the text was not drawn, rebuild it now
+		markDirty(TextStage::Raster);
+	}
+
+	TexelVector buffer(0, 0, {});
+	publishTexture(runStages(buffer), buffer);
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::makeTextBackground()
+{
+	if (prepare_job.valid())
+	{
+		if (prepare_mode == PrepareMode::BackgroundWait
+			|| prepare_job.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+		{
+			finishJob();
+		}
+	}
+
+	// scrolling selects other tiles of the layout drawn now, so it is applied
+	// here instead of lagging a worker round trip behind
+	auto version = pending_version.load(std::memory_order_acquire);
+	auto state = std::atomic_load(&pending_state);
+	if (viewport)
+	{
+		applyScroll(*state);
+	}
+	if (prepare_job.valid())
+	{
+		// still preparing, the last ready texture is drawn meanwhile
+		if (viewport)
+			updateTiles();
+		return;
+	}
+	if (version != consumed_version && submitted_state && isScrollOnly(*submitted_state, *state))
+	{
+		// the twin gets the new position with the next job
+		consumed_version = version;
+	}
+
+	if (shared_texture)
+	{
+		texture = TextureCache::instance().getTexture(shared_texture);
+	}
+	// evicted storage is composited again in the background as well
+	bool evicted = texture.tex_id && !viewport && !renderer_type::isTextureResident(texture.tex_id);
+	if (version == consumed_version && !evicted)
+	{
+		if (viewport)
+			updateTiles();
+		return;
+	}
+
+	submitJob(evicted);
+	if (prepare_mode == PrepareMode::BackgroundWait)
+	{
+		finishJob();
+	}
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::submitJob(bool evicted)
+{
+	if (!worker_text)
 	{
-		text_changed = true;
+		worker_text.reset(new BasicLazyText(font));
 	}
-	BaseText::setSpacing(spacing);
-	BaseText::prepareText();
+
+	// the twin is idle between jobs, so it can be handed the newest state directly
+	submitted_version = pending_version.load(std::memory_order_acquire);
+	submitted_state = std::atomic_load(&pending_state);
+	std::atomic_store(&worker_text->pending_state, submitted_state);
+	worker_text->pending_version.fetch_add(1, std::memory_order_release);
+	if (evicted)
+	{
+		worker_text->markDirty(TextStage::Raster);
+	}
+
+	auto worker = worker_text.get();
+	auto buffer = &worker_buffer;
+	prepare_job = TextWorkerPool::instance().submit([worker, buffer]
+	{
+		std::lock_guard<std::mutex> lck(worker->lazy_mutex);
+		TraceSpan span("LazyText::prepareText");
+		try
+		{
+			return worker->runStages(*buffer) ? JobStatus::Rastered : JobStatus::Prepared;
+		}
+		catch (const std::exception& e)
+		{
+			// stages that did not finish stay dirty in the twin and run again with the next job
+			// an acquired cache entry is left to finishJob, only the render thread releases textures
+			Statistics::instance().add(Stat::PrepareFailures);
+			worker->prepare_error = e.what();
+			*buffer = TexelVector(0, 0, {});
+			return JobStatus::Failed;
+		}
+	});
 }
 
-void LazyText::setMaxLineLength(float length)
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::finishJob()
 {
-	attempt_to_break = true;
-	if (max_line_length != length)
+	auto status = prepare_job.get();
+	auto&& w = *worker_text;
+	// taken from the twin whatever the status, so a dropped entry is released here
+	auto acquired = std::move(w.next_shared_texture);
+	w.next_shared_texture.reset();
+	prepare_error = std::move(w.prepare_error);
+	w.prepare_error.clear();
+	if (status == JobStatus::Failed)
 	{
-		needs_rebreaking = true;
+		// not retried until something is set again
+		consumed_version = submitted_version;
+		return;
 	}
-	max_line_length = length;
+	bool rastered = status == JobStatus::Rastered;
+
+	// adopt the layout of the twin, drawing and tiles need nothing else
+	font = w.font;
+	fallback_names = w.fallback_names;
+	Base::fallback_fonts = w.fallback_fonts;
+	Base::text_styles = w.text_styles;
+	Base::text_char_styles = w.text_char_styles;
+	text_effects = w.text_effects;
+	text = w.text;
+	Base::text_lines = w.text_lines;
+	Base::text_lines_w = w.text_lines_w;
+	Base::text_lines_start = w.text_lines_start;
+	Base::text_lines_baseline = w.text_lines_baseline;
+	Base::text_lines_caret = w.text_lines_caret;
+	Base::text_lines_extent = w.text_lines_extent;
+	text_align = w.text_align;
+	Base::text_border = w.text_border;
+	text_offset = w.text_offset;
+	Base::text_size = w.text_size;
+	Base::x_height = w.x_height;
+	Base::text_baseline = w.text_baseline;
+	text_width = w.text_width;
+	Base::text_height = w.text_height;
+	text_spacing = w.text_spacing;
+	text_interline = w.text_interline;
+	texture.tex_w = w.texture.tex_w;
+	texture.tex_h = w.texture.tex_h;
+
+	// as well as its inputs, so switching back to the inline mode rebuilds nothing
+	source_text_u8 = w.source_text_u8;
+	source_text = w.source_text;
+	source_styled = w.source_styled;
+	unbroken_text = w.unbroken_text;
+	attempt_to_break = w.attempt_to_break;
+	max_line_length = w.max_line_length;
+	viewport = w.viewport;
+	viewport_top = w.viewport_top;
+	viewport_rows = w.viewport_rows;
+	viewport_prefetch = w.viewport_prefetch;
+	tile_rows = w.tile_rows;
+	max_tiles = w.max_tiles;
+	if (rastered)
+	{
+		next_shared_texture = std::move(acquired);
+	}
+	consumed_version = submitted_version;
+	dirty_stages = 0;
+
+	publishTexture(rastered, worker_buffer);
 }
 
-void LazyText::setFont(std::shared_ptr<TrueTypeFont> font_ptr)
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::updateTiles()
 {
-	if (font_ptr.get() != font.get())
+	int tile_count = (texture.tex_h + tile_rows - 1) / tile_rows;
+	int first = std::max(0, (viewport_top - viewport_prefetch) / tile_rows);
+	int last = std::min(tile_count, (viewport_top + viewport_rows + viewport_prefetch + tile_rows - 1) / tile_rows);
+
+	for (int k = first; k < last; ++k)
 	{
-		text_changed = true;
+		auto&& tile = tiles[k];
+		if (tile.texture.tex_id == 0 || !renderer_type::isTextureResident(tile.texture.tex_id))
+		{
+			int top = k * tile_rows;
+			auto buffer = Base::rasterText(top, std::min(tile_rows, texture.tex_h - top));
+			tile.texture.tex_w = static_cast<int>(buffer.get_w());
+			tile.texture.tex_h = static_cast<int>(buffer.get_h());
+			Base::uploadText(tile.texture, buffer);
+		}
+		tile.last_used = ++tile_tick;
+	}
+
+	// constant memory: drop the least recently used tiles outside the window
+	size_t window = static_cast<size_t>(std::max(0, last - first));
+	size_t capacity = std::max(window, max_tiles ? max_tiles : window * 2);
+	while (tiles.size() > capacity)
+	{
+		auto victim = tiles.end();
+		for (auto it = tiles.begin(); it != tiles.end(); ++it)
+		{
+			if (it->first >= first && it->first < last)
+				continue;
+			if (victim == tiles.end() || it->second.last_used < victim->second.last_used)
+				victim = it;
+		}
+		if (victim == tiles.end())
+			break;
+		renderer_type::deleteTexture(victim->second.texture.tex_id);
+		tiles.erase(victim);
 	}
-	BaseText::setFont(font_ptr);
-	BaseText::prepareText();
 }
 
-void LazyText::setFont(std::string font_name, int font_size)
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::releaseTiles()
 {
-	auto font_ptr = FontRepository::instance().getFont(font_name, font_size);
-	if (font_ptr.get() != font.get())
+	for (auto&& tile : tiles)
 	{
-		text_changed = true;
+		renderer_type::deleteTexture(tile.second.texture.tex_id);
 	}
-	BaseText::setFont(font_ptr);
-	BaseText::prepareText();
+	tiles.clear();
 }
 
-void LazyText::makeText()
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::drawTiles(int x, int y)
+{
+	// the texture is placed as drawText places it, scrolled up by viewport_top
+	Base::textureOrigin(x, y);
+	auto c = text_color;
+	int bottom = viewport_top + viewport_rows;
+	for (auto&& t : tiles)
+	{
+		auto&& tile = t.second.texture;
+		int top = t.first * tile_rows;
+		int r0 = std::max(top, viewport_top);
+		int r1 = std::min(top + tile.tex_h, bottom);
+		if (r1 <= r0 || tile.tex_h == 0)
+			continue;
+
+		// only the rows inside the viewport, the prefetched ones stay hidden
+		GLfloat v0 = static_cast<GLfloat>(r0 - top) / tile.tex_h * tile.tex_v;
+		GLfloat v1 = static_cast<GLfloat>(r1 - top) / tile.tex_h * tile.tex_v;
+		Base::drawClipped(tile.tex_id, { x, y + r0 - viewport_top, tile.tex_w, r1 - r0 },
+			{ c.r, c.g, c.b, c.a }, { 0.0f, v0, tile.tex_u, v1 - v0 });
+	}
+}
+
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::textureOrigin(int& x, int& y)
+{
+	Base::textureOrigin(x, y);
+	if (viewport)
+	{
+		// drawTiles puts texture row viewport_top where row 0 is drawn otherwise
+		y -= viewport_top;
+	}
+}
+
+template <typename renderer_type>
+size_t BasicLazyText<renderer_type>::hitTest(int x, int y)
+{
+	std::lock_guard<std::mutex> lck(lazy_mutex);
+	return Base::hitTest(x, y);
+}
+
+template <typename renderer_type>
+typename BasicLazyText<renderer_type>::Rect BasicLazyText<renderer_type>::caretRect(size_t index)
 {
 	std::lock_guard<std::mutex> lck(lazy_mutex);
-	if (text_changed)
+	return Base::caretRect(index);
+}
+
+template <typename renderer_type>
+bool BasicLazyText<renderer_type>::takeDamage(int x, int y, Rect& damage)
+{
+	this->makeText();
+	auto rect = getTextRect(x, y);
+	std::lock_guard<std::mutex> lck(lazy_mutex);
+	return Base::updateDamage(rect, x, y, damage);
+}
+
+template <typename renderer_type>
+typename BasicLazyText<renderer_type>::Rect BasicLazyText<renderer_type>::getTextRect(int x, int y)
+{
+	std::lock_guard<std::mutex> lck(lazy_mutex);
+	if (viewport)
 	{
-		BaseText::makeText();
+		Base::textureOrigin(x, y);
+		return { x, y, texture.tex_w, std::min(viewport_rows, std::max(texture.tex_h - viewport_top, 0)) };
 	}
-	text_changed = false;
+	return Base::getTextRect(x, y);
 }
 
-void LazyText::drawText(int x, int y)
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::drawText(int x, int y)
 {
 	this->makeText();
 	std::lock_guard<std::mutex> lck(lazy_mutex);
-	BaseText::drawText(x, y);
+	if (viewport)
+	{
+		drawTiles(x, y);
+		return;
+	}
+	Base::drawText(x, y);
 }
 
-void LazyText::drawAll(int x, int y)
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::drawAll(int x, int y)
 {
 	this->makeText();
 	std::lock_guard<std::mutex> lck(lazy_mutex);
-	BaseText::drawAll(x, y);
+	if (viewport)
+	{
+		drawTiles(x, y);
+		return;
+	}
+	Base::drawAll(x, y);
 }
 
-LazyText::StringType LazyText::fitText(LazyText::StringType text)
+template <typename renderer_type>
+typename BasicLazyText<renderer_type>::StringType BasicLazyText<renderer_type>::fitText(StringType text)
+{
+	return fitText(std::move(text), max_line_length);
+}
+
+template <typename renderer_type>
+typename BasicLazyText<renderer_type>::StringType BasicLazyText<renderer_type>::fitText(StringType text, float length)
 {
 	using pos_t = typename std::basic_string<StringValueType>::size_type;
 	StringValueType newline{ '\n' };
 	StringValueType whitespace{ ' ' }; //TODO: no-break space (0x00A0) / CJK ideographic space (0x3000)
-	// auto words = BaseText::split(text, { whitespace, newline });
-	auto words = BaseText::split(text, { whitespace });
+	// auto words = Base::split(text, { whitespace, newline });
+	auto words = Base::split(text, { whitespace });
 
 	auto it = text.begin();
 	// std::unordered_set<StringValueType> separator{ whitespace, newline };
@@ -146,12 +988,11 @@ LazyText::StringType LazyText::fitText(LazyText::StringType text)
 	for (size_t i = 0; i < separator_index.size(); ++i)
 	{
 		auto sep_p = separator_index[i];
-		auto pre_p = separator_index[std::max<size_t>(i - 1, 0)];
-		auto p_it = it + p;
+		auto pre_p = separator_index[i > 0 ? i - 1 : 0];
 		auto sep_it = it + sep_p;
 		auto pre_it = it + pre_p;
 
-		if (BaseText::measureString({ p_it, sep_it }) > max_line_length)
+		if (Base::measureSpan(text, p, sep_p) > length)
 		{
 			if (*pre_it == newline)
 			{
@@ -168,17 +1009,35 @@ LazyText::StringType LazyText::fitText(LazyText::StringType text)
 	return text;
 }
 
-float LazyText::measureString(std::string s)
+template <typename renderer_type>
+float BasicLazyText<renderer_type>::measureString(std::string s)
+{
+	return Base::measureString(to_u32string(s));
+}
+
+template <typename renderer_type>
+float BasicLazyText<renderer_type>::measureString(std::u16string s)
 {
-	return BaseText::measureString(to_u32string(s));
+	return Base::measureString(to_u32string(s));
 }
 
-float LazyText::measureString(std::u16string s)
+template <typename renderer_type>
+float BasicLazyText<renderer_type>::measureString(std::wstring s)
 {
-	return BaseText::measureString(to_u32string(s));
+	return Base::measureString(to_u32string(s));
 }
 
-float LazyText::measureString(std::wstring s)
+template <typename renderer_type>
+void BasicLazyText<renderer_type>::measureStrings(const std::string* strings, size_t count, float* widths, float* heights)
 {
-	return BaseText::measureString(to_u32string(s));
+	std::wstring_convert<std::codecvt_utf8<char32_t>, char32_t> converter;
+	std::vector<StringType> decoded;
+	decoded.reserve(count);
+	for (size_t i = 0; i < count; ++i)
+		decoded.push_back(converter.from_bytes(strings[i]));
+	Base::measureStrings(decoded.data(), count, widths, heights);
 }
+
+
+template class BasicLazyText<BaseTextRendererGL2>;
+template class BasicLazyText<BaseTextRendererNull>;
@@ -1,49 +1,256 @@
 #pragma once
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <vector>
 
 #include "BaseText.h"
+#include "TextTextureCache.h"
 
 
-class LazyText : public BaseText<std::u32string>
+template <typename renderer_type = BaseTextRendererGL2>
+class BasicLazyText : public BaseText<std::u32string, renderer_type>
 {
 private:
-	std::mutex lazy_mutex;
-	bool text_changed{ true };
+	typedef BaseText<std::u32string, renderer_type> Base;
+
+public:
+	using typename Base::StringType;
+	using typename Base::StringValueType;
+	using typename Base::TextAlign;
+	using typename Base::TextStage;
+	using typename Base::TextStyle;
+	using typename Base::TextEffect;
+	using typename Base::TextEffectKind;
+	using typename Base::TextStageRuns;
+	using typename Base::Rect;
+
+	// where decode, wrap, layout and composite run, the upload is always done by drawText
+	enum class PrepareMode
+	{
+		Inline, // drawText prepares a changed text before drawing it
+		Background, // a worker prepares it, drawText keeps drawing the last ready texture
+		BackgroundWait, // a worker prepares it, drawText waits for it (deterministic output)
+	};
+
+	// a fragment of styled text, see setStyledText
+	struct TextRun
+	{
+		std::string text;
+		std::string font_name{}; // empty: font of the text
+		int font_size{ 0 }; // 0: size of the text font
+		int r{ 255 };
+		int g{ 255 };
+		int b{ 255 };
+		int a{ 255 };
+		float spacing{ 0.0f };
+	};
+
+protected:
+	using Base::font;
+	using Base::text;
+	using Base::fallback_names;
+	using Base::text_effects;
+	using Base::text_align;
+	using Base::text_spacing;
+	using Base::text_interline;
+	using Base::text_color;
+	using Base::text_origin;
+	using Base::text_offset;
+	using Base::text_width;
+	using Base::texture;
+	using Base::countStage;
+
+public:
+	using Base::u8_to_u32;
+	using Base::to_u32string;
+
+private:
+	struct StyledText
+	{
+		StringType text;
+		std::vector<TextStyle> styles;
+		std::vector<uint16_t> char_styles;
+	};
+
+	// state written by producer threads, picked up by the render thread
+	struct TextState
+	{
+		std::shared_ptr<const std::string> text_u8;
+		std::shared_ptr<const StringType> text;
+		std::shared_ptr<const StyledText> styled;
+		std::shared_ptr<TrueTypeFont> font;
+		std::vector<std::string> fallback_names;
+		std::vector<TextEffect> effects;
+		FT_Pos spacing{ 0 };
+		FT_Pos interline{ 0 };
+		TextAlign align{ TextAlign::Left };
+		float max_line_length{};
+		bool attempt_to_break{ false };
+		bool viewport{ false };
+		int viewport_top{ 0 };
+		int viewport_rows{ 0 };
+		int viewport_prefetch{ 0 };
+		int tile_rows{ 256 };
+		size_t max_tiles{ 0 };
+	};
+
+	// horizontal band of the text texture, used in the viewport mode
+	struct TextTile
+	{
+		GLtexture texture{};
+		uint64_t last_used{ 0 };
+	};
+
+private:
+	mutable std::mutex lazy_mutex;
+	unsigned dirty_stages{ ~0u };
+
+private:
+	std::shared_ptr<const TextState> pending_state;
+	std::atomic<uint64_t> pending_version{ 0 };
+	uint64_t consumed_version{ 0 };
 
 private:
+	std::shared_ptr<const std::string> source_text_u8;
+	std::shared_ptr<const StringType> source_text;
+	std::shared_ptr<const StyledText> source_styled;
 	StringType unbroken_text;
 	bool attempt_to_break{ false };
-	bool needs_rebreaking{ false };
 	float max_line_length{};
 
+private:
+	std::map<int, TextTile> tiles;
+	uint64_t tile_tick{ 0 };
+	bool viewport{ false };
+	int viewport_top{ 0 };
+	int viewport_rows{ 0 };
+	int viewport_prefetch{ 0 };
+	int tile_rows{ 256 };
+	size_t max_tiles{ 0 };
+
+private:
+	// background preparation: a twin of this text runs the CPU stages on a worker,
+	// its layout is adopted once the job is done and only the upload is left here
+	enum class JobStatus
+	{
+		Prepared, // layout changed, the texture did not
+		Rastered,
+		Failed, // the job threw, the last good layout and texture are kept
+	};
+
+	PrepareMode prepare_mode{ PrepareMode::Inline };
+	std::unique_ptr<BasicLazyText> worker_text;
+	TexelVector worker_buffer{ 0, 0, {} };
+	std::future<JobStatus> prepare_job;
+	std::shared_ptr<const TextState> submitted_state;
+	uint64_t submitted_version{ 0 };
+	std::string prepare_error;
+
+private:
+	// identical texts draw one shared texture, see TextTextureCache; the entry
+	// acquired by the last raster stage is taken over by publishTexture
+	typedef TextTextureCache<renderer_type> TextureCache;
+	typename TextureCache::EntryPtr shared_texture;
+	typename TextureCache::EntryPtr next_shared_texture;
+
 public:
-	// LazyText(){}
-	LazyText(std::string font_name, int font_size);
-	LazyText(std::shared_ptr<TrueTypeFont> font_ptr);
+	// BasicLazyText(){}
+	BasicLazyText(std::string font_name, int font_size);
+	BasicLazyText(std::shared_ptr<TrueTypeFont> font_ptr);
+	~BasicLazyText();
+
+private:
+	template <typename F>
+	void publishState(F&& update);
+	bool consumeState();
+	void applyState(const TextState& state);
+	void applyScroll(const TextState& state);
+	static bool isScrollOnly(const TextState& from, const TextState& to);
+
+private:
+	void markDirty(TextStage stage);
+	bool isDirty(TextStage stage) const;
+	bool decodeText();
+	bool wrapText();
+	bool runStages(TexelVector& buffer);
+	typename TextureCache::EntryPtr acquireTexture();
+	void publishTexture(bool rastered, TexelVector& buffer);
+	void releaseTexture();
+	void makeTextBackground();
+	void submitJob(bool evicted);
+	void finishJob();
+	void updateTiles();
+	void releaseTiles();
+	void drawTiles(int x, int y);
+	void textureOrigin(int& x, int& y) override;
 
 public:
 	void setText(StringType new_text);
 	void setText(std::string new_text);
 	void setText(std::u16string new_text);
 	void setText(std::wstring new_text);
+	// one text, one layout, one texture: runs differ in font, size, color and spacing;
+	// throws std::length_error for more than 65536 runs
+	void setStyledText(const std::vector<TextRun>& runs);
 	void setFontSize(int font_size);
 	void setSpacing(float spacing);
+	void setLineSpacing(float spacing);
 	void setMaxLineLength(float length);
+	void setAlign(TextAlign align);
 	void setFont(std::string font_name, int font_size);
 	void setFont(std::shared_ptr<TrueTypeFont> font_ptr);
+	void setFallbackFonts(std::vector<std::string> font_names);
+	// shadow, outline and glow below the glyphs, masks are cached per glyph by the font
+	void setEffects(std::vector<TextEffect> effects);
+
+public:
+	// viewport mode: the whole text is laid out, but only tiles of tile_rows
+	// texture rows covering [top - prefetch, top + rows + prefetch) are composited
+	// and kept (least recently used first out, max_tiles 0 means twice the window)
+	void setViewport(int top, int rows, int prefetch = 0);
+	void setTileCache(int tile_rows, size_t max_tiles = 0);
+	void clearViewport();
+	size_t getTileCount() const;
 
 public:
+	void setPrepareMode(PrepareMode mode);
+	PrepareMode getPrepareMode() const;
+	// false while a background job is preparing a newer version of the text
+	bool isReady();
+	// what the last background job threw (its text kept the last good texture),
+	// empty once a job succeeds again; failures are counted in Stat::PrepareFailures
+	std::string getPrepareError() const;
+	size_t getStageRuns(TextStage stage) const;
+	TextStageRuns getStageRuns() const;
+
+public:
+	// picks up the setters published since the last build; layout getters
+	// (getWidth, getLineCount, ...) answer for the text as of the last makeText
 	void makeText();
 	void drawText(int x, int y);
 	void drawAll(int x, int y);
+	Rect getTextRect(int x, int y);
+	// over the layout drawn last, scrolled with the viewport
+	size_t hitTest(int x, int y) override;
+	Rect caretRect(size_t index) override;
+	// builds the text first, as drawText would
+	bool takeDamage(int x, int y, Rect& damage) override;
 
 public:
 	StringType fitText(StringType text);
+	StringType fitText(StringType text, float length);
 	float measureString(std::string s);
 	float measureString(std::u16string s);
 	float measureString(std::wstring s);
+	using Base::measureStrings;
+	// decoded with one converter for the whole batch
+	void measureStrings(const std::string* strings, size_t count, float* widths, float* heights = nullptr);
 
 };
+
+typedef BasicLazyText<BaseTextRendererGL2> LazyText;
@@ -0,0 +1,157 @@
+#include "MemoryResource.h"
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+
+constexpr size_t Memory::CategoryCount;
+
+namespace
+{
+	class NewDeleteResource : public MemoryResource
+	{
+	public:
+		void* allocate(size_t bytes, size_t) override
+		{
+			return ::operator new(bytes);
+		}
+
+		void deallocate(void* p, size_t, size_t) override
+		{
+			::operator delete(p);
+		}
+	};
+
+	MemoryResource* defaultResource()
+	{
+		static NewDeleteResource* resource = new NewDeleteResource();
+		return resource;
+	}
+}
+
+Memory::Memory()
+{
+	resource.store(defaultResource());
+}
+
+Memory& Memory::instance()
+{
+	// never destroyed, fonts and textures of other singletons free their memory at exit
+	static std::aligned_storage<sizeof(Memory), alignof(Memory)>::type storage;
+	static Memory* memory = new (&storage) Memory();
+	return *memory;
+}
+
+const char* Memory::getName(MemoryCategory category)
+{
+	static const char* names[CategoryCount] = {
+		"glyphs",
+		"glyph_bitmaps",
+		"glyph_outlines",
+		"glyph_packed",
+		"coverage",
+		"texels",
+		"layout",
+	};
+	return names[static_cast<size_t>(category)];
+}
+
+void Memory::setResource(MemoryResource* new_resource)
+{
+	resource.store(new_resource ? new_resource : defaultResource());
+}
+
+MemoryResource* Memory::getResource() const
+{
+	return resource.load();
+}
+
+size_t Memory::headerSize(size_t alignment)
+{
+	// keeps the block aligned as requested and the stored pointer aligned as well
+	return std::max(alignment, sizeof(MemoryResource*));
+}
+
+void* Memory::allocate(MemoryCategory category, size_t bytes, size_t alignment)
+{
+	auto header = headerSize(alignment);
+	if (bytes > std::numeric_limits<size_t>::max() - header)
+		throw std::bad_alloc();
+	auto owner = resource.load(std::memory_order_acquire);
+	auto block = static_cast<char*>(owner->allocate(bytes + header, header));
+	auto p = block + header;
+	std::memcpy(p - sizeof(MemoryResource*), &owner, sizeof(MemoryResource*));
+	auto&& c = counters[static_cast<size_t>(category)];
+	c.allocations.fetch_add(1, std::memory_order_relaxed);
+	c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+	c.live_bytes.fetch_add(bytes, std::memory_order_relaxed);
+	return p;
+}
+
+void Memory::deallocate(MemoryCategory category, void* p, size_t bytes, size_t alignment)
+{
+	if (p == nullptr)
+		return;
+
+	auto header = headerSize(alignment);
+	auto block = static_cast<char*>(p) - header;
+	MemoryResource* owner;
+	std::memcpy(&owner, block + header - sizeof(MemoryResource*), sizeof(MemoryResource*));
+	owner->deallocate(block, bytes + header, header);
+	auto&& c = counters[static_cast<size_t>(category)];
+	c.deallocations.fetch_add(1, std::memory_order_relaxed);
+	c.live_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+Memory::Snapshot Memory::getSnapshot() const
+{
+	Snapshot snapshot;
+	for (size_t i = 0; i < CategoryCount; ++i)
+	{
+		snapshot.allocations[i] = counters[i].allocations.load(std::memory_order_relaxed);
+		snapshot.deallocations[i] = counters[i].deallocations.load(std::memory_order_relaxed);
+		snapshot.bytes[i] = counters[i].bytes.load(std::memory_order_relaxed);
+		snapshot.live_bytes[i] = counters[i].live_bytes.load(std::memory_order_relaxed);
+	}
+	return snapshot;
+}
+
+void Memory::reset()
+{
+	for (auto&& c : counters)
+	{
+		c.allocations.store(0, std::memory_order_relaxed);
+		c.deallocations.store(0, std::memory_order_relaxed);
+		c.bytes.store(0, std::memory_order_relaxed);
+	}
+}
+
+uint64_t Memory::Snapshot::getAllocations() const
+{
+	uint64_t total = 0;
+	for (auto n : allocations)
+		total += n;
+	return total;
+}
+
+uint64_t Memory::Snapshot::getLiveBytes() const
+{
+	uint64_t total = 0;
+	for (auto n : live_bytes)
+		total += n;
+	return total;
+}
+
+void Memory::Snapshot::writeJson(std::ostream& os) const
+{
+	os << "{";
+	for (size_t i = 0; i < CategoryCount; ++i)
+	{
+		os << (i ? ", " : " ") << "\"" << getName(static_cast<MemoryCategory>(i)) << "\": { ";
+		os << "\"allocations\": " << allocations[i] << ", ";
+		os << "\"deallocations\": " << deallocations[i] << ", ";
+		os << "\"bytes\": " << bytes[i] << ", ";
+		os << "\"live_bytes\": " << live_bytes[i] << " }";
+	}
+	os << " }";
+}
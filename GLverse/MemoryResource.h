@@ -0,0 +1,128 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <ostream>
+
+
+enum class MemoryCategory : size_t
+{
+	Glyphs = 0, // glyph records
+	GlyphBitmaps,
+	GlyphOutlines,
+	GlyphPacked, // run-length encoded bitmaps of the compact storage
+	Coverage, // effect masks and layers
+	Texels, // composited text buffers
+	Layout, // line tables
+	Count
+};
+
+
+// Where the library allocates glyph, coverage, texel and line table storage
+// from (the categories below). Text strings, UTF conversion temporaries, hash
+// map nodes and most shared_ptr control blocks stay on the global heap. Each
+// block goes back to the resource it came from, so a resource may be switched
+// at any time, but has to stay alive until all of its blocks are freed.
+class MemoryResource
+{
+public:
+	virtual ~MemoryResource() = default;
+	virtual void* allocate(size_t bytes, size_t alignment) = 0;
+	virtual void deallocate(void* p, size_t bytes, size_t alignment) = 0;
+};
+
+
+class Memory
+{
+public:
+	static constexpr size_t CategoryCount = static_cast<size_t>(MemoryCategory::Count);
+
+	struct Snapshot
+	{
+		std::array<uint64_t, CategoryCount> allocations{};
+		std::array<uint64_t, CategoryCount> deallocations{};
+		std::array<uint64_t, CategoryCount> bytes{}; // allocated in total
+		std::array<uint64_t, CategoryCount> live_bytes{};
+		uint64_t getAllocations() const;
+		uint64_t getLiveBytes() const;
+		void writeJson(std::ostream& os) const;
+	};
+
+private:
+	struct alignas(64) Counters
+	{
+		std::atomic<uint64_t> allocations{ 0 };
+		std::atomic<uint64_t> deallocations{ 0 };
+		std::atomic<uint64_t> bytes{ 0 };
+		std::atomic<uint64_t> live_bytes{ 0 };
+	};
+
+private:
+	std::array<Counters, CategoryCount> counters;
+	std::atomic<MemoryResource*> resource;
+
+private:
+	Memory();
+	// each block is preceded by the resource that allocated it
+	static size_t headerSize(size_t alignment);
+
+public:
+	static Memory& instance();
+	static const char* getName(MemoryCategory category);
+
+public:
+	// nullptr restores the default resource (operator new)
+	void setResource(MemoryResource* new_resource);
+	MemoryResource* getResource() const;
+
+public:
+	void* allocate(MemoryCategory category, size_t bytes, size_t alignment = alignof(std::max_align_t));
+	void deallocate(MemoryCategory category, void* p, size_t bytes, size_t alignment = alignof(std::max_align_t));
+
+public:
+	Snapshot getSnapshot() const;
+	// clears the totals, live bytes are kept
+	void reset();
+
+};
+
+
+// standard allocator accounting under one category, for library containers
+template <typename T, MemoryCategory category>
+class MemoryAllocator
+{
+public:
+	typedef T value_type;
+
+	template <typename U>
+	struct rebind
+	{
+		typedef MemoryAllocator<U, category> other;
+	};
+
+public:
+	MemoryAllocator() = default;
+	template <typename U>
+	MemoryAllocator(const MemoryAllocator<U, category>&) {}
+
+public:
+	T* allocate(size_t n)
+	{
+		if (n > std::numeric_limits<size_t>::max() / sizeof(T))
+			throw std::bad_alloc();
+		return static_cast<T*>(Memory::instance().allocate(category, n * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T* p, size_t n)
+	{
+		Memory::instance().deallocate(category, p, n * sizeof(T), alignof(T));
+	}
+
+	template <typename U>
+	bool operator==(const MemoryAllocator<U, category>&) const { return true; }
+	template <typename U>
+	bool operator!=(const MemoryAllocator<U, category>&) const { return false; }
+};
@@ -1,3 +1,14 @@
 #pragma once
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+
+
+struct GLtexture
+{
+	GLuint tex_id{ 0 };
+	int tex_w{ 0 };
+	int tex_h{ 0 };
+	// extent of the content within the (possibly larger) texture storage
+	GLfloat tex_u{ 1.0f };
+	GLfloat tex_v{ 1.0f };
+};
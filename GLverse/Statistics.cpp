@@ -0,0 +1,161 @@
+#include "Statistics.h"
+#include <algorithm>
+
+
+constexpr size_t Statistics::StatCount;
+
+Statistics& Statistics::instance()
+{
+	static Statistics statistics{};
+	return statistics;
+}
+
+const char* Statistics::getName(Stat stat)
+{
+	static const char* names[StatCount] = {
+		"glyph_hits",
+		"glyph_misses",
+		"glyph_evictions",
+		"glyph_load_ns",
+		"glyph_unpacks",
+		"glyph_unpack_ns",
+		"metrics_hits",
+		"metrics_misses",
+		"kerning_lookups",
+		"glyph_fallbacks",
+		"glyph_missing",
+		"fallback_fonts_skipped",
+		"mask_hits",
+		"mask_misses",
+		"mask_ns",
+		"layout_ns",
+		"prepare_failures",
+		"composite_count",
+		"composite_ns",
+		"upload_count",
+		"upload_bytes",
+		"upload_ns",
+		"upload_latency_ns",
+		"texture_evictions",
+		"font_lock_waits",
+		"font_lock_wait_ns",
+		"base_lock_waits",
+		"base_lock_wait_ns",
+	};
+	return names[static_cast<size_t>(stat)];
+}
+
+void Statistics::Snapshot::writeJson(std::ostream& os) const
+{
+	os << "{";
+	for (size_t i = 0; i < StatCount; ++i)
+	{
+		os << (i ? ", " : " ") << "\"" << getName(static_cast<Stat>(i)) << "\": " << values[i];
+	}
+	os << " }";
+}
+
+Statistics::LocalHandle::~LocalHandle()
+{
+	Statistics::instance().detach(counters);
+}
+
+Statistics::LocalCounters* Statistics::attach()
+{
+	auto counters = new LocalCounters();
+	std::lock_guard<std::mutex> lck(local_mutex);
+	locals.push_back(counters);
+	return counters;
+}
+
+void Statistics::detach(LocalCounters* counters)
+{
+	std::lock_guard<std::mutex> lck(local_mutex);
+	for (size_t i = 0; i < StatCount; ++i)
+	{
+		retired[i] += counters->values[i].load(std::memory_order_relaxed);
+	}
+	locals.erase(std::remove(locals.begin(), locals.end(), counters), locals.end());
+	delete counters;
+}
+
+std::array<uint64_t, Statistics::StatCount> Statistics::sum() const
+{
+	auto values = retired;
+	for (auto&& counters : locals)
+	{
+		for (size_t i = 0; i < StatCount; ++i)
+		{
+			values[i] += counters->values[i].load(std::memory_order_relaxed);
+		}
+	}
+	return values;
+}
+
+Statistics::Snapshot Statistics::getSnapshot() const
+{
+	std::lock_guard<std::mutex> lck(local_mutex);
+	Snapshot snapshot;
+	snapshot.values = sum();
+	for (size_t i = 0; i < StatCount; ++i)
+	{
+		snapshot.values[i] -= reset_base[i];
+	}
+	return snapshot;
+}
+
+void Statistics::reset()
+{
+	// the blocks belong to their threads, so the current sums become the zero
+	std::lock_guard<std::mutex> lck(local_mutex);
+	reset_base = sum();
+}
+
+void Statistics::setTracing(bool enabled, size_t capacity)
+{
+	std::lock_guard<std::mutex> lck(trace_mutex);
+	trace_capacity = capacity;
+	if (enabled)
+	{
+		trace_events.reserve(std::min<size_t>(trace_capacity, 1 << 16));
+	}
+	tracing.store(enabled, std::memory_order_relaxed);
+}
+
+void Statistics::addTraceEvent(const char* name, clock::time_point start, clock::time_point stop)
+{
+	static std::atomic<uint32_t> next_tid{ 1 };
+	thread_local uint32_t tid = next_tid++;
+
+	auto ts = std::chrono::duration_cast<std::chrono::nanoseconds>(start - trace_epoch).count();
+	auto dur = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+
+	std::lock_guard<std::mutex> lck(trace_mutex);
+	if (trace_events.size() < trace_capacity)
+	{
+		trace_events.push_back({ name, tid, ts, dur });
+	}
+}
+
+void Statistics::exportTrace(std::ostream& os) const
+{
+	// Chrome trace-event format (chrome://tracing, Perfetto), complete events
+	std::lock_guard<std::mutex> lck(trace_mutex);
+	os << "{\"traceEvents\":[\n";
+	for (size_t i = 0; i < trace_events.size(); ++i)
+	{
+		auto&& e = trace_events[i];
+		os << "{\"name\":\"" << e.name << "\",\"cat\":\"GLverse\",\"ph\":\"X\",\"pid\":1";
+		os << ",\"tid\":" << e.tid;
+		os << ",\"ts\":" << e.ts_ns / 1000 << "." << (e.ts_ns % 1000) / 100;
+		os << ",\"dur\":" << e.dur_ns / 1000 << "." << (e.dur_ns % 1000) / 100;
+		os << (i + 1 < trace_events.size() ? "},\n" : "}\n");
+	}
+	os << "],\"displayTimeUnit\":\"ms\"}\n";
+}
+
+void Statistics::clearTrace()
+{
+	std::lock_guard<std::mutex> lck(trace_mutex);
+	trace_events.clear();
+}
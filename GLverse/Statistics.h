@@ -0,0 +1,208 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+
+enum class Stat : size_t
+{
+	GlyphHits = 0,
+	GlyphMisses,
+	GlyphEvictions,
+	GlyphLoadNs,
+	GlyphUnpacks,
+	GlyphUnpackNs,
+	MetricsHits,
+	MetricsMisses,
+	KerningLookups,
+	GlyphFallbacks,
+	GlyphMissing,
+	FallbackFontsSkipped,
+	MaskHits,
+	MaskMisses,
+	MaskNs,
+	LayoutNs,
+	PrepareFailures,
+	CompositeCount,
+	CompositeNs,
+	UploadCount,
+	UploadBytes,
+	UploadNs,
+	UploadLatencyNs,
+	TextureEvictions,
+	FontLockWaits,
+	FontLockWaitNs,
+	BaseLockWaits,
+	BaseLockWaitNs,
+	Count
+};
+
+
+class Statistics
+{
+public:
+	typedef std::chrono::steady_clock clock;
+	static constexpr size_t StatCount = static_cast<size_t>(Stat::Count);
+
+	struct Snapshot
+	{
+		std::array<uint64_t, StatCount> values{};
+		uint64_t operator[](Stat stat) const { return values[static_cast<size_t>(stat)]; }
+		void writeJson(std::ostream& os) const;
+	};
+
+private:
+	// counters of one thread: written by it alone, without locked instructions,
+	// and summed up by snapshots; blocks of threads do not share cache lines
+	// (padded rather than aligned, C++14 operator new ignores extended alignment)
+	struct LocalCounters
+	{
+		char head_pad[64];
+		std::array<std::atomic<uint64_t>, StatCount> values{};
+		char tail_pad[64];
+	};
+
+	struct LocalHandle
+	{
+		LocalCounters* counters;
+		~LocalHandle();
+	};
+
+	struct TraceEvent
+	{
+		const char* name;
+		uint32_t tid;
+		int64_t ts_ns;
+		int64_t dur_ns;
+	};
+
+private:
+	mutable std::mutex local_mutex;
+	std::vector<LocalCounters*> locals;
+	// folded in from exited threads
+	std::array<uint64_t, StatCount> retired{};
+	// raw sums at the last reset, snapshots count from there
+	std::array<uint64_t, StatCount> reset_base{};
+
+private:
+	mutable std::mutex trace_mutex;
+	std::atomic<bool> tracing{ false };
+	std::vector<TraceEvent> trace_events;
+	size_t trace_capacity{ 1 << 20 };
+	clock::time_point trace_epoch{ clock::now() };
+
+private:
+	Statistics() = default;
+
+public:
+	static Statistics& instance();
+	static const char* getName(Stat stat);
+
+public:
+	void add(Stat stat, uint64_t value = 1)
+	{
+		// only this thread writes its block, so a plain load and store will do
+		auto&& counter = local().values[static_cast<size_t>(stat)];
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	Snapshot getSnapshot() const;
+	void reset();
+
+private:
+	LocalCounters& local()
+	{
+		thread_local LocalHandle handle{ attach() };
+		return *handle.counters;
+	}
+
+	LocalCounters* attach();
+	void detach(LocalCounters* counters);
+	std::array<uint64_t, StatCount> sum() const;
+
+public:
+	bool isTracing() const
+	{
+		return tracing.load(std::memory_order_relaxed);
+	}
+
+	void setTracing(bool enabled, size_t capacity = 1 << 20);
+	void addTraceEvent(const char* name, clock::time_point start, clock::time_point stop);
+	void exportTrace(std::ostream& os) const;
+	void clearTrace();
+
+};
+
+
+class ScopedStatTimer
+{
+private:
+	Stat stat;
+	Statistics::clock::time_point start{ Statistics::clock::now() };
+
+public:
+	explicit ScopedStatTimer(Stat stat) : stat{ stat } {}
+	~ScopedStatTimer()
+	{
+		auto elapsed = Statistics::clock::now() - start;
+		Statistics::instance().add(stat, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+	}
+};
+
+
+class TraceSpan
+{
+private:
+	const char* name{ nullptr };
+	Statistics::clock::time_point start;
+
+public:
+	// name has to outlive the trace, string literals are the intended use
+	explicit TraceSpan(const char* span_name)
+	{
+		if (Statistics::instance().isTracing())
+		{
+			name = span_name;
+			start = Statistics::clock::now();
+		}
+	}
+	~TraceSpan()
+	{
+		if (name)
+		{
+			Statistics::instance().addTraceEvent(name, start, Statistics::clock::now());
+		}
+	}
+};
+
+
+// lock_guard, that accounts the time spent waiting for a contended mutex
+template <typename Mutex>
+class StatisticsLock
+{
+private:
+	Mutex& mutex;
+
+public:
+	StatisticsLock(Mutex& m, Stat waits, Stat wait_ns) : mutex{ m }
+	{
+		if (mutex.try_lock())
+			return;
+
+		auto start = Statistics::clock::now();
+		mutex.lock();
+		auto elapsed = Statistics::clock::now() - start;
+		Statistics::instance().add(waits);
+		Statistics::instance().add(wait_ns, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+	}
+	StatisticsLock(const StatisticsLock&) = delete;
+	StatisticsLock& operator=(const StatisticsLock&) = delete;
+	~StatisticsLock()
+	{
+		mutex.unlock();
+	}
+};
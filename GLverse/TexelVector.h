@@ -1,6 +1,7 @@
 #pragma once
 #include <cstdint>
 #include <vector>
+#include "MemoryResource.h"
 
 
 namespace TexelVectorElement
@@ -17,8 +18,11 @@ namespace TexelVectorElement
 namespace TVE = TexelVectorElement;
 
 
-class TexelVector : public std::vector<TVE::BGRATexel>
+class TexelVector : public std::vector<TVE::BGRATexel, MemoryAllocator<TVE::BGRATexel, MemoryCategory::Texels>>
 {
+private:
+	typedef std::vector<TVE::BGRATexel, MemoryAllocator<TVE::BGRATexel, MemoryCategory::Texels>> Base;
+
 private:
 	size_t tex_w{};
 	size_t tex_h{};
@@ -34,12 +38,12 @@ public:
 public:
 	decltype(auto) at(size_t pos)
 	{
-		return std::vector<TVE::BGRATexel>::at(pos);
+		return Base::at(pos);
 	}
 
 	decltype(auto) at(size_t x, size_t y)
 	{
-		return std::vector<TVE::BGRATexel>::at(tex_w * y + x);
+		return Base::at(tex_w * y + x);
 	}
 
 	auto get_w() const
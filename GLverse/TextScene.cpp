@@ -0,0 +1,295 @@
+#include "TextScene.h"
+#include "BaseTextRendererNull.h"
+#include <algorithm>
+#include <cmath>
+
+
+template <typename text_type>
+BasicTextScene<text_type>::BasicTextScene(int cell_size):
+	cell_size{ std::max(cell_size, 1) }
+{
+}
+
+template <typename text_type>
+typename BasicTextScene<text_type>::Handle BasicTextScene<text_type>::add(text_type& text, int x, int y, int group)
+{
+	std::lock_guard<std::mutex> lck(scene_mutex);
+	Handle handle;
+	if (!free_entries.empty())
+	{
+		handle = free_entries.back();
+		free_entries.pop_back();
+	}
+	else
+	{
+		handle = entries.size();
+		entries.emplace_back();
+	}
+
+	auto&& entry = entries[handle];
+	entry = Entry{};
+	entry.text = &text;
+	entry.x = x;
+	entry.y = y;
+	entry.group = group;
+	place(handle);
+	return handle;
+}
+
+template <typename text_type>
+void BasicTextScene<text_type>::remove(Handle handle)
+{
+	std::lock_guard<std::mutex> lck(scene_mutex);
+	if (handle >= entries.size() || entries[handle].text == nullptr)
+		return;
+
+	unplace(handle);
+	entries[handle].text = nullptr;
+	free_entries.push_back(handle);
+}
+
+template <typename text_type>
+void BasicTextScene<text_type>::move(Handle handle, int x, int y)
+{
+	std::lock_guard<std::mutex> lck(scene_mutex);
+	if (handle >= entries.size() || entries[handle].text == nullptr)
+		return;
+
+	auto&& entry = entries[handle];
+	unplace(handle);
+	entry.bounds.x += x - entry.x;
+	entry.bounds.y += y - entry.y;
+	entry.x = x;
+	entry.y = y;
+	place(handle);
+}
+
+template <typename text_type>
+void BasicTextScene<text_type>::setGroup(Handle handle, int group)
+{
+	std::lock_guard<std::mutex> lck(scene_mutex);
+	if (handle < entries.size())
+	{
+		entries[handle].group = group;
+	}
+}
+
+template <typename text_type>
+void BasicTextScene<text_type>::invalidate(Handle handle)
+{
+	std::lock_guard<std::mutex> lck(scene_mutex);
+	if (handle >= entries.size() || entries[handle].text == nullptr)
+		return;
+
+	unplace(handle);
+	entries[handle].known = false;
+	place(handle);
+}
+
+template <typename text_type>
+size_t BasicTextScene<text_type>::getTextCount() const
+{
+	std::lock_guard<std::mutex> lck(scene_mutex);
+	return entries.size() - free_entries.size();
+}
+
+template <typename text_type>
+void BasicTextScene<text_type>::setViewport(int x, int y, int w, int h)
+{
+	std::lock_guard<std::mutex> lck(scene_mutex);
+	viewport_enabled = true;
+	viewport = { x, y, std::max(w, 0), std::max(h, 0) };
+}
+
+template <typename text_type>
+void BasicTextScene<text_type>::clearViewport()
+{
+	std::lock_guard<std::mutex> lck(scene_mutex);
+	viewport_enabled = false;
+}
+
+template <typename text_type>
+void BasicTextScene<text_type>::setGroupClip(int group, int x, int y, int w, int h)
+{
+	std::lock_guard<std::mutex> lck(scene_mutex);
+	groups[group] = { true, { x, y, std::max(w, 0), std::max(h, 0) } };
+}
+
+template <typename text_type>
+void BasicTextScene<text_type>::clearGroupClip(int group)
+{
+	std::lock_guard<std::mutex> lck(scene_mutex);
+	groups.erase(group);
+}
+
+template <typename text_type>
+uint64_t BasicTextScene<text_type>::cellKey(int cx, int cy)
+{
+	return (static_cast<uint64_t>(static_cast<uint32_t>(cx)) << 32) | static_cast<uint32_t>(cy);
+}
+
+template <typename text_type>
+typename BasicTextScene<text_type>::Cells BasicTextScene<text_type>::cellsOf(const Rect& r) const
+{
+	Cells cells;
+	cells.x0 = static_cast<int>(std::floor(r.x / cell_size));
+	cells.y0 = static_cast<int>(std::floor(r.y / cell_size));
+	cells.x1 = static_cast<int>(std::floor((r.x + std::max(r.w, 1.0f) - 1) / cell_size));
+	cells.y1 = static_cast<int>(std::floor((r.y + std::max(r.h, 1.0f) - 1) / cell_size));
+	return cells;
+}
+
+template <typename text_type>
+void BasicTextScene<text_type>::place(Handle handle)
+{
+	auto&& entry = entries[handle];
+	if (!entry.known)
+	{
+		// never built: a candidate in every frame until its bounds are known
+		unplaced.push_back(handle);
+		return;
+	}
+
+	entry.cells = cellsOf(entry.bounds);
+	for (int cy = entry.cells.y0; cy <= entry.cells.y1; ++cy)
+	{
+		for (int cx = entry.cells.x0; cx <= entry.cells.x1; ++cx)
+		{
+			grid[cellKey(cx, cy)].push_back(handle);
+		}
+	}
+}
+
+template <typename text_type>
+void BasicTextScene<text_type>::unplace(Handle handle)
+{
+	auto&& entry = entries[handle];
+	if (!entry.known)
+	{
+		unplaced.erase(std::remove(unplaced.begin(), unplaced.end(), handle), unplaced.end());
+		return;
+	}
+
+	for (int cy = entry.cells.y0; cy <= entry.cells.y1; ++cy)
+	{
+		for (int cx = entry.cells.x0; cx <= entry.cells.x1; ++cx)
+		{
+			auto cell = grid.find(cellKey(cx, cy));
+			if (cell == grid.end())
+				continue;
+			auto&& handles = cell->second;
+			handles.erase(std::remove(handles.begin(), handles.end(), handle), handles.end());
+			if (handles.empty())
+				grid.erase(cell);
+		}
+	}
+	entry.cells = Cells{};
+}
+
+template <typename text_type>
+bool BasicTextScene<text_type>::visible(const Entry& entry) const
+{
+	if (!entry.known)
+		return true;
+
+	auto group = groups.find(entry.group);
+	bool clipped = group != groups.end() && group->second.clipped;
+	if (!viewport_enabled && !clipped)
+		return true;
+
+	auto area = viewport_enabled ? viewport : group->second.clip;
+	if (viewport_enabled && clipped)
+		area = text_type::intersectRect(area, group->second.clip);
+	auto overlap = text_type::intersectRect(entry.bounds, area);
+	return overlap.w > 0 && overlap.h > 0;
+}
+
+template <typename text_type>
+void BasicTextScene<text_type>::draw()
+{
+	std::lock_guard<std::mutex> lck(scene_mutex);
+	FrameStats stats;
+	stats.frame = frame_stats.frame + 1;
+	stats.texts = entries.size() - free_entries.size();
+
+	// candidates of the cells covering the viewport, each one once
+	std::vector<Handle> candidates;
+	if (!viewport_enabled)
+	{
+		for (Handle handle = 0; handle < entries.size(); ++handle)
+		{
+			if (entries[handle].text)
+				candidates.push_back(handle);
+		}
+	}
+	else
+	{
+		candidates = unplaced;
+		++visit_tick;
+		for (auto handle : unplaced)
+		{
+			entries[handle].visit = visit_tick;
+		}
+		auto view = cellsOf(viewport);
+		for (int cy = view.y0; viewport.w > 0 && viewport.h > 0 && cy <= view.y1; ++cy)
+		{
+			for (int cx = view.x0; cx <= view.x1; ++cx)
+			{
+				auto cell = grid.find(cellKey(cx, cy));
+				if (cell == grid.end())
+					continue;
+				for (auto handle : cell->second)
+				{
+					if (entries[handle].visit == visit_tick)
+						continue;
+					entries[handle].visit = visit_tick;
+					candidates.push_back(handle);
+				}
+			}
+		}
+	}
+	// texts added first are drawn first, as without the scene
+	std::sort(candidates.begin(), candidates.end());
+	stats.visited = candidates.size();
+
+	for (auto handle : candidates)
+	{
+		auto&& entry = entries[handle];
+		if (!visible(entry))
+			continue;
+
+		auto group = groups.find(entry.group);
+		if (group != groups.end() && group->second.clipped)
+			entry.text->setGroupClip(group->second.clip);
+		else
+			entry.text->clearGroupClip();
+		entry.text->drawText(entry.x, entry.y);
+		stats.drawn++;
+
+		// the build may have changed the bounds, empty ones (e.g. a text still
+		// prepared in the background) stay unplaced until there is a texture
+		auto bounds = entry.text->getTextRect(entry.x, entry.y);
+		bool known = bounds.w > 0 && bounds.h > 0;
+		if (known != entry.known || bounds.x != entry.bounds.x || bounds.y != entry.bounds.y
+			|| bounds.w != entry.bounds.w || bounds.h != entry.bounds.h)
+		{
+			unplace(handle);
+			entry.bounds = bounds;
+			entry.known = known;
+			place(handle);
+		}
+	}
+	stats.culled = stats.texts - stats.drawn;
+	frame_stats = stats;
+}
+
+template <typename text_type>
+typename BasicTextScene<text_type>::FrameStats BasicTextScene<text_type>::getFrameStats() const
+{
+	std::lock_guard<std::mutex> lck(scene_mutex);
+	return frame_stats;
+}
+
+
+template class BasicTextScene<BasicLazyText<BaseTextRendererGL2>>;
+template class BasicTextScene<BasicLazyText<BaseTextRendererNull>>;
@@ -0,0 +1,105 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "LazyText.h"
+
+
+// Many texts placed on one screen, indexed by a uniform grid of their bounds.
+// Only texts whose bounds meet the viewport (and the clip of their group) are
+// drawn, the others are neither drawn nor rebuilt, their changes wait until
+// they are scrolled into view again.
+template <typename text_type = LazyText>
+class BasicTextScene
+{
+public:
+	typedef typename text_type::Rect Rect;
+	typedef size_t Handle;
+
+	struct FrameStats
+	{
+		uint64_t frame{ 0 };
+		size_t texts{ 0 };
+		size_t visited{ 0 }; // candidates found in the grid cells of the viewport
+		size_t drawn{ 0 };
+		size_t culled{ 0 };
+	};
+
+private:
+	struct Cells
+	{
+		int x0{ 0 };
+		int y0{ 0 };
+		int x1{ -1 };
+		int y1{ -1 };
+	};
+
+	struct Entry
+	{
+		text_type* text{ nullptr };
+		int x{ 0 };
+		int y{ 0 };
+		int group{ 0 };
+		Rect bounds{ 0, 0, 0, 0 };
+		Cells cells{};
+		bool known{ false }; // bounds are known only after the first build
+		uint64_t visit{ 0 };
+	};
+
+	struct Group
+	{
+		bool clipped{ false };
+		Rect clip{ 0, 0, 0, 0 };
+	};
+
+private:
+	mutable std::mutex scene_mutex;
+	std::vector<Entry> entries;
+	std::vector<Handle> free_entries;
+	std::vector<Handle> unplaced;
+	std::unordered_map<uint64_t, std::vector<Handle>> grid;
+	std::unordered_map<int, Group> groups;
+	int cell_size{ 256 };
+	bool viewport_enabled{ false };
+	Rect viewport{ 0, 0, 0, 0 };
+	uint64_t visit_tick{ 0 };
+	FrameStats frame_stats{};
+
+public:
+	explicit BasicTextScene(int cell_size = 256);
+
+public:
+	// texts are not owned, they have to outlive the scene or be removed first
+	Handle add(text_type& text, int x, int y, int group = 0);
+	void remove(Handle handle);
+	void move(Handle handle, int x, int y);
+	void setGroup(Handle handle, int group);
+	// bounds are refreshed on every draw, this forces a rebuild of a text whose
+	// new content might reach into the viewport while its old bounds do not
+	void invalidate(Handle handle);
+	size_t getTextCount() const;
+
+public:
+	// without a viewport every text is drawn, only group clips cull
+	void setViewport(int x, int y, int w, int h);
+	void clearViewport();
+	void setGroupClip(int group, int x, int y, int w, int h);
+	void clearGroupClip(int group);
+
+public:
+	void draw();
+	FrameStats getFrameStats() const;
+
+private:
+	static uint64_t cellKey(int cx, int cy);
+	Cells cellsOf(const Rect& r) const;
+	void place(Handle handle);
+	void unplace(Handle handle);
+	bool visible(const Entry& entry) const;
+
+};
+
+typedef BasicTextScene<LazyText> TextScene;
@@ -0,0 +1,499 @@
+#include "TextSystem.h"
+#include "BaseTextRendererNull.h"
+#include <algorithm>
+#include <cmath>
+
+
+template <typename renderer_type>
+constexpr typename BasicTextSystem<renderer_type>::Handle BasicTextSystem<renderer_type>::InvalidHandle;
+template <typename renderer_type>
+constexpr uint32_t BasicTextSystem<renderer_type>::NoSlot;
+
+template <typename renderer_type>
+BasicTextSystem<renderer_type>::~BasicTextSystem()
+{
+	for (auto&& texture : textures)
+	{
+		renderer_type::deleteTexture(texture.tex_id);
+	}
+}
+
+template <typename renderer_type>
+typename BasicTextSystem<renderer_type>::StyleId BasicTextSystem<renderer_type>::addStyle(std::shared_ptr<TrueTypeFont> font)
+{
+	std::lock_guard<std::mutex> lck(system_mutex);
+	Style s;
+	s.font = font;
+	s.compositor.reset(new Compositor(font));
+	styles.push_back(std::move(s));
+	return static_cast<StyleId>(styles.size() - 1);
+}
+
+template <typename renderer_type>
+typename BasicTextSystem<renderer_type>::StyleId BasicTextSystem<renderer_type>::addStyle(std::string font_name, int font_size)
+{
+	return addStyle(FontRepository::instance().getFont(font_name, font_size));
+}
+
+template <typename renderer_type>
+typename BasicTextSystem<renderer_type>::Handle BasicTextSystem<renderer_type>::create(const std::u32string& text, StyleId new_style, int x, int y)
+{
+	std::lock_guard<std::mutex> lck(system_mutex);
+	if (new_style >= styles.size())
+		return InvalidHandle;
+
+	uint32_t index;
+	if (!free_labels.empty())
+	{
+		index = free_labels.back();
+		free_labels.pop_back();
+	}
+	else
+	{
+		// the highest index would make up InvalidHandle
+		if (flags.size() >= IndexMask)
+			return InvalidHandle;
+		index = static_cast<uint32_t>(flags.size());
+		flags.push_back(0);
+		generation.push_back(0);
+		style.push_back(0);
+		text_start.push_back(0);
+		text_length.push_back(0);
+		pos_x.push_back(0);
+		pos_y.push_back(0);
+		color.push_back(0);
+		bounds_x.push_back(0);
+		bounds_y.push_back(0);
+		bounds_w.push_back(0);
+		bounds_h.push_back(0);
+		texture_slot.push_back(NoSlot);
+		atlas_page.push_back(Atlas::NoPage);
+		atlas_x.push_back(0);
+		atlas_y.push_back(0);
+	}
+
+	flags[index] = Alive | Rebuild;
+	style[index] = new_style;
+	pos_x[index] = x;
+	pos_y[index] = y;
+	color[index] = 0xffffffff;
+	bounds_x[index] = 0;
+	bounds_y[index] = 0;
+	bounds_w[index] = 0;
+	bounds_h[index] = 0;
+	text_length[index] = 0;
+	assignText(index, text);
+	return (static_cast<Handle>(generation[index]) << IndexBits) | index;
+}
+
+template <typename renderer_type>
+typename BasicTextSystem<renderer_type>::Handle BasicTextSystem<renderer_type>::create(const std::string& text, StyleId new_style, int x, int y)
+{
+	return create(Compositor::u8_to_u32(text), new_style, x, y);
+}
+
+template <typename renderer_type>
+void BasicTextSystem<renderer_type>::destroy(Handle handle)
+{
+	std::lock_guard<std::mutex> lck(system_mutex);
+	uint32_t index;
+	if (!lookup(handle, index))
+		return;
+
+	releaseSlot(index);
+	releaseRegion(index);
+	chars_garbage += text_length[index];
+	text_length[index] = 0;
+	flags[index] = 0;
+	// a wrapped generation would make old handles valid again
+	if (++generation[index] != 0)
+		free_labels.push_back(index);
+	else
+		retired_labels++;
+}
+
+template <typename renderer_type>
+bool BasicTextSystem<renderer_type>::isValid(Handle handle) const
+{
+	std::lock_guard<std::mutex> lck(system_mutex);
+	uint32_t index;
+	return lookup(handle, index);
+}
+
+template <typename renderer_type>
+size_t BasicTextSystem<renderer_type>::getLabelCount() const
+{
+	std::lock_guard<std::mutex> lck(system_mutex);
+	return flags.size() - free_labels.size() - retired_labels;
+}
+
+template <typename renderer_type>
+void BasicTextSystem<renderer_type>::setText(Handle handle, const std::u32string& text)
+{
+	std::lock_guard<std::mutex> lck(system_mutex);
+	uint32_t index;
+	if (!lookup(handle, index))
+		return;
+
+	if (text.size() == text_length[index] && chars.compare(text_start[index], text_length[index], text) == 0)
+		return;
+	assignText(index, text);
+	flags[index] |= Rebuild;
+}
+
+template <typename renderer_type>
+void BasicTextSystem<renderer_type>::setText(Handle handle, const std::string& text)
+{
+	setText(handle, Compositor::u8_to_u32(text));
+}
+
+template <typename renderer_type>
+void BasicTextSystem<renderer_type>::setStyle(Handle handle, StyleId new_style)
+{
+	std::lock_guard<std::mutex> lck(system_mutex);
+	uint32_t index;
+	if (!lookup(handle, index) || new_style >= styles.size() || new_style == style[index])
+		return;
+
+	style[index] = new_style;
+	flags[index] |= Rebuild;
+}
+
+template <typename renderer_type>
+void BasicTextSystem<renderer_type>::setPosition(Handle handle, int x, int y)
+{
+	std::lock_guard<std::mutex> lck(system_mutex);
+	uint32_t index;
+	if (!lookup(handle, index))
+		return;
+
+	pos_x[index] = x;
+	pos_y[index] = y;
+}
+
+template <typename renderer_type>
+void BasicTextSystem<renderer_type>::setColor(Handle handle, float r, float g, float b, float a)
+{
+	std::lock_guard<std::mutex> lck(system_mutex);
+	uint32_t index;
+	if (!lookup(handle, index))
+		return;
+
+	auto channel = [](float v, int shift)
+	{
+		return static_cast<uint32_t>(std::lround(std::min(std::max(v, 0.0f), 1.0f) * 255.0f)) << shift;
+	};
+	color[index] = channel(r, 24) | channel(g, 16) | channel(b, 8) | channel(a, 0);
+}
+
+template <typename renderer_type>
+typename BasicTextSystem<renderer_type>::Rect BasicTextSystem<renderer_type>::getBounds(Handle handle) const
+{
+	std::lock_guard<std::mutex> lck(system_mutex);
+	uint32_t index;
+	if (!lookup(handle, index))
+		return { 0, 0, 0, 0 };
+
+	return { pos_x[index] + bounds_x[index], pos_y[index] + bounds_y[index], static_cast<int>(bounds_w[index]), static_cast<int>(bounds_h[index]) };
+}
+
+template <typename renderer_type>
+void BasicTextSystem<renderer_type>::setAtlas(bool enabled, int page_size)
+{
+	std::lock_guard<std::mutex> lck(system_mutex);
+	// every label is packed again, or gets a texture of its own
+	for (uint32_t i = 0; i < flags.size(); ++i)
+	{
+		atlas_page[i] = Atlas::NoPage;
+		if (flags[i] & Alive)
+			flags[i] |= Rebuild;
+	}
+	atlas.reset(enabled ? new Atlas(page_size) : nullptr);
+}
+
+template <typename renderer_type>
+typename BasicTextSystem<renderer_type>::Atlas::Usage BasicTextSystem<renderer_type>::getAtlasUsage() const
+{
+	std::lock_guard<std::mutex> lck(system_mutex);
+	return atlas ? atlas->getUsage() : typename Atlas::Usage{};
+}
+
+template <typename renderer_type>
+void BasicTextSystem<renderer_type>::update()
+{
+	std::lock_guard<std::mutex> lck(system_mutex);
+	TraceSpan span("TextSystem::update");
+	if (chars_garbage > 4096 && chars_garbage > chars.size() / 2)
+	{
+		compactText();
+	}
+	if (atlas)
+	{
+		// a page left mostly holes by destroyed or resized labels is packed again,
+		// one per update so that the labels composited again are spread over frames
+		auto fragmented = atlas->getFragmentedPages();
+		if (!fragmented.empty())
+		{
+			auto page = fragmented.front();
+			atlas->reset(page);
+			for (uint32_t i = 0; i < flags.size(); ++i)
+			{
+				if (atlas_page[i] != page)
+					continue;
+				atlas_page[i] = Atlas::NoPage;
+				flags[i] |= Rebuild;
+			}
+		}
+	}
+
+	std::vector<uint32_t> changed;
+	for (uint32_t i = 0; i < flags.size(); ++i)
+	{
+		if ((flags[i] & (Alive | Rebuild)) == (Alive | Rebuild))
+			changed.push_back(i);
+	}
+	// one style after the other, each compositor keeps its font state warm
+	std::stable_sort(changed.begin(), changed.end(), [this](uint32_t a, uint32_t b) { return style[a] < style[b]; });
+	for (auto i : changed)
+	{
+		rebuild(i);
+	}
+	frame_stats.rebuilt = changed.size();
+	if (atlas)
+	{
+		atlas->trim();
+	}
+}
+
+template <typename renderer_type>
+void BasicTextSystem<renderer_type>::draw()
+{
+	update();
+
+	std::lock_guard<std::mutex> lck(system_mutex);
+	TraceSpan span("TextSystem::draw");
+	FrameStats stats;
+	stats.frame = frame_stats.frame + 1;
+	stats.rebuilt = frame_stats.rebuilt;
+	if (atlas)
+	{
+		// evicted pages come back blank, once per page rather than per label
+		for (uint32_t page = 0; page < atlas->getPageCount(); ++page)
+		{
+			if (atlas->isResident(page))
+				continue;
+			atlas->restore(page);
+			for (uint32_t i = 0; i < flags.size(); ++i)
+			{
+				if (atlas_page[i] == page)
+				{
+					rebuild(i);
+					stats.rebuilt++;
+				}
+			}
+		}
+	}
+
+	GLuint last_tex_id = 0;
+	for (uint32_t i = 0; i < flags.size(); ++i)
+	{
+		if (!(flags[i] & Alive))
+			continue;
+
+		stats.labels++;
+		if (texture_slot[i] != NoSlot && !renderer_type::isTextureResident(textures[texture_slot[i]].tex_id))
+		{
+			// storage was evicted while the label was not drawn
+			rebuild(i);
+			stats.rebuilt++;
+		}
+
+		GLuint tex_id;
+		Rect uv{ 0.0f, 0.0f, 1.0f, 1.0f };
+		if (atlas_page[i] != Atlas::NoPage)
+		{
+			tex_id = atlas->getTexture(atlas_page[i]);
+			uv = atlas->getUV(regionOf(i));
+		}
+		else
+		{
+			if (texture_slot[i] == NoSlot)
+				continue;
+			auto&& texture = textures[texture_slot[i]];
+			tex_id = texture.tex_id;
+			uv = { 0.0f, 0.0f, texture.tex_u, texture.tex_v };
+		}
+
+		uint32_t c = color[i];
+		if ((c & 0xff) == 0)
+			continue;
+		Rect r{ pos_x[i] + bounds_x[i], pos_y[i] + bounds_y[i], static_cast<int>(bounds_w[i]), static_cast<int>(bounds_h[i]) };
+		renderer_type::drawTexture(tex_id, r,
+			{ (c >> 24) / 255.0f, (c >> 16 & 0xff) / 255.0f, (c >> 8 & 0xff) / 255.0f, (c & 0xff) / 255.0f },
+			uv);
+		if (tex_id != last_tex_id)
+			stats.texture_changes++;
+		last_tex_id = tex_id;
+		stats.drawn++;
+	}
+	frame_stats = stats;
+}
+
+template <typename renderer_type>
+typename BasicTextSystem<renderer_type>::FrameStats BasicTextSystem<renderer_type>::getFrameStats() const
+{
+	std::lock_guard<std::mutex> lck(system_mutex);
+	return frame_stats;
+}
+
+template <typename renderer_type>
+bool BasicTextSystem<renderer_type>::lookup(Handle handle, uint32_t& index) const
+{
+	index = static_cast<uint32_t>(handle & IndexMask);
+	return handle != InvalidHandle && index < flags.size() && (flags[index] & Alive) && generation[index] == (handle >> IndexBits);
+}
+
+template <typename renderer_type>
+void BasicTextSystem<renderer_type>::assignText(uint32_t index, const std::u32string& text)
+{
+	// shorter texts are written in place, longer ones are appended
+	if (text.size() <= text_length[index])
+	{
+		chars.replace(text_start[index], text.size(), text);
+		chars_garbage += text_length[index] - text.size();
+	}
+	else
+	{
+		chars_garbage += text_length[index];
+		text_start[index] = static_cast<uint32_t>(chars.size());
+		chars += text;
+	}
+	text_length[index] = static_cast<uint32_t>(text.size());
+}
+
+template <typename renderer_type>
+void BasicTextSystem<renderer_type>::compactText()
+{
+	std::u32string compacted;
+	compacted.reserve(chars.size() - chars_garbage);
+	for (uint32_t i = 0; i < flags.size(); ++i)
+	{
+		if (!(flags[i] & Alive))
+			continue;
+		uint32_t start = static_cast<uint32_t>(compacted.size());
+		compacted.append(chars, text_start[i], text_length[i]);
+		text_start[i] = start;
+	}
+	chars.swap(compacted);
+	chars_garbage = 0;
+}
+
+template <typename renderer_type>
+void BasicTextSystem<renderer_type>::rebuild(uint32_t index)
+{
+	flags[index] &= ~Rebuild;
+	auto&& compositor = *styles[style[index]].compositor;
+	compositor.setText(chars.substr(text_start[index], text_length[index]));
+	compositor.prepareText();
+	auto buffer = compositor.rasterText();
+	auto bounds = compositor.getTextRect(0, 0);
+	auto region = regionOf(index);
+	bounds_x[index] = static_cast<int16_t>(bounds.x);
+	bounds_y[index] = static_cast<int16_t>(bounds.y);
+	bounds_w[index] = static_cast<uint16_t>(bounds.w);
+	bounds_h[index] = static_cast<uint16_t>(bounds.h);
+
+	int w = static_cast<int>(buffer.get_w());
+	int h = static_cast<int>(buffer.get_h());
+	if (atlas && atlas->fits(w, h))
+	{
+		// a region of the same size is written over in place
+		if (region.page != Atlas::NoPage && (region.w != w || region.h != h))
+		{
+			atlas->release(region);
+			atlas_page[index] = Atlas::NoPage;
+		}
+		if (region.page != Atlas::NoPage || atlas->allocate(w, h, region))
+		{
+			releaseSlot(index);
+			atlas_page[index] = region.page;
+			atlas_x[index] = static_cast<uint16_t>(region.x);
+			atlas_y[index] = static_cast<uint16_t>(region.y);
+			if (!atlas->upload(region, buffer))
+				invalidatePage(region.page, index);
+			return;
+		}
+	}
+	releaseRegion(index);
+
+	if (texture_slot[index] == NoSlot)
+	{
+		if (!free_slots.empty())
+		{
+			texture_slot[index] = free_slots.back();
+			free_slots.pop_back();
+		}
+		else
+		{
+			texture_slot[index] = static_cast<uint32_t>(textures.size());
+			textures.emplace_back();
+		}
+	}
+	auto&& texture = textures[texture_slot[index]];
+	texture.tex_w = static_cast<int>(buffer.get_w());
+	texture.tex_h = static_cast<int>(buffer.get_h());
+	compositor.uploadText(texture, buffer);
+}
+
+template <typename renderer_type>
+void BasicTextSystem<renderer_type>::releaseSlot(uint32_t index)
+{
+	if (texture_slot[index] == NoSlot)
+		return;
+
+	auto&& texture = textures[texture_slot[index]];
+	renderer_type::deleteTexture(texture.tex_id);
+	texture = GLtexture{};
+	free_slots.push_back(texture_slot[index]);
+	texture_slot[index] = NoSlot;
+}
+
+template <typename renderer_type>
+typename BasicTextSystem<renderer_type>::Atlas::Region BasicTextSystem<renderer_type>::regionOf(uint32_t index) const
+{
+	typename Atlas::Region region;
+	if (atlas_page[index] != Atlas::NoPage)
+	{
+		region.page = atlas_page[index];
+		region.x = atlas_x[index];
+		region.y = atlas_y[index];
+		region.w = bounds_w[index];
+		region.h = bounds_h[index];
+	}
+	return region;
+}
+
+template <typename renderer_type>
+void BasicTextSystem<renderer_type>::releaseRegion(uint32_t index)
+{
+	if (atlas_page[index] == Atlas::NoPage)
+		return;
+
+	auto region = regionOf(index);
+	atlas->release(region);
+	atlas_page[index] = Atlas::NoPage;
+}
+
+template <typename renderer_type>
+void BasicTextSystem<renderer_type>::invalidatePage(uint32_t page, uint32_t except)
+{
+	for (uint32_t i = 0; i < flags.size(); ++i)
+	{
+		if (i != except && atlas_page[i] == page)
+			flags[i] |= Rebuild;
+	}
+}
+
+
+template class BasicTextSystem<BaseTextRendererGL2>;
+template class BasicTextSystem<BaseTextRendererNull>;
@@ -0,0 +1,153 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "BaseText.h"
+#include "LabelAtlas.h"
+
+
+// Many small single line labels without an object each: a label is a handle
+// into arrays of its fields (struct of arrays), its text is a range of one
+// shared character pool, and all labels of a style share one compositor.
+// Changed labels are laid out, composited and uploaded together by update(),
+// draw() draws every label in one pass. Composites of labels that are small
+// enough are packed into the shared pages of a LabelAtlas, so most labels are
+// drawn from one texture. For paragraphs, wrapping, styled runs or effects use
+// LazyText.
+template <typename renderer_type = BaseTextRendererGL2>
+class BasicTextSystem
+{
+public:
+	typedef BaseText<std::u32string, renderer_type> Compositor;
+	typedef LabelAtlas<renderer_type> Atlas;
+	typedef typename renderer_type::Rect Rect;
+	// index and generation, 32 bits each: a handle of a destroyed label stays
+	// invalid, a slot is retired instead of reused once its generation would wrap
+	typedef uint64_t Handle;
+	typedef uint16_t StyleId;
+
+	static constexpr Handle InvalidHandle = ~Handle{ 0 };
+
+	struct FrameStats
+	{
+		uint64_t frame{ 0 };
+		size_t labels{ 0 };
+		size_t rebuilt{ 0 };
+		size_t drawn{ 0 };
+		size_t texture_changes{ 0 }; // between consecutive labels
+	};
+
+private:
+	static constexpr uint32_t IndexBits = 32;
+	static constexpr Handle IndexMask = (Handle{ 1 } << IndexBits) - 1;
+	static constexpr uint32_t NoSlot = 0xffffffff;
+
+	enum LabelFlags : uint8_t
+	{
+		Alive = 1,
+		Rebuild = 2, // text or style changed, or its texture was evicted
+	};
+
+	struct Style
+	{
+		std::shared_ptr<TrueTypeFont> font;
+		std::unique_ptr<Compositor> compositor;
+	};
+
+private:
+	mutable std::mutex system_mutex;
+	std::vector<Style> styles;
+
+private:
+	// one element per label in each array, passes only touch the arrays they need
+	std::vector<uint8_t> flags;
+	std::vector<uint32_t> generation;
+	std::vector<StyleId> style;
+	std::vector<uint32_t> text_start; // in chars
+	std::vector<uint32_t> text_length;
+	std::vector<int32_t> pos_x;
+	std::vector<int32_t> pos_y;
+	std::vector<uint32_t> color; // RGBA, 8 bits each, applied when drawing
+	// texture rectangle relative to the position, as of the last build
+	std::vector<int16_t> bounds_x;
+	std::vector<int16_t> bounds_y;
+	std::vector<uint16_t> bounds_w;
+	std::vector<uint16_t> bounds_h;
+	std::vector<uint32_t> texture_slot;
+	// region of the composite in the atlas (its size is the bounds), or NoPage
+	std::vector<uint32_t> atlas_page;
+	std::vector<uint16_t> atlas_x;
+	std::vector<uint16_t> atlas_y;
+	std::vector<uint32_t> free_labels;
+	size_t retired_labels{ 0 };
+
+private:
+	// the texts of all labels; replaced texts leave garbage behind until compaction
+	std::u32string chars;
+	size_t chars_garbage{ 0 };
+
+private:
+	std::vector<GLtexture> textures;
+	std::vector<uint32_t> free_slots;
+	std::unique_ptr<Atlas> atlas{ new Atlas() };
+
+private:
+	FrameStats frame_stats{};
+
+public:
+	BasicTextSystem() = default;
+	~BasicTextSystem();
+	BasicTextSystem(const BasicTextSystem&) = delete;
+	BasicTextSystem& operator=(const BasicTextSystem&) = delete;
+
+public:
+	StyleId addStyle(std::shared_ptr<TrueTypeFont> font);
+	StyleId addStyle(std::string font_name, int font_size);
+
+public:
+	// InvalidHandle for a style not added to this system
+	Handle create(const std::u32string& text, StyleId style, int x, int y);
+	Handle create(const std::string& text, StyleId style, int x, int y);
+	void destroy(Handle handle);
+	bool isValid(Handle handle) const;
+	size_t getLabelCount() const;
+
+public:
+	void setText(Handle handle, const std::u32string& text);
+	void setText(Handle handle, const std::string& text);
+	void setStyle(Handle handle, StyleId style);
+	void setPosition(Handle handle, int x, int y);
+	void setColor(Handle handle, float r, float g, float b, float a = 1.0f);
+	// screen rectangle drawn for the label, as of the last update
+	Rect getBounds(Handle handle) const;
+
+public:
+	// on by default; labels larger than a quarter page keep a texture of their own
+	void setAtlas(bool enabled, int page_size = 1024);
+	typename Atlas::Usage getAtlasUsage() const;
+
+public:
+	// lays out, composites and uploads every changed label, grouped by style
+	void update();
+	// update(), then every label, evicted textures are rebuilt on the way
+	void draw();
+	FrameStats getFrameStats() const;
+
+private:
+	bool lookup(Handle handle, uint32_t& index) const;
+	void assignText(uint32_t index, const std::u32string& text);
+	void compactText();
+	void rebuild(uint32_t index);
+	void releaseSlot(uint32_t index);
+	typename Atlas::Region regionOf(uint32_t index) const;
+	void releaseRegion(uint32_t index);
+	// labels packed into the page (but one) are blank, they are composited again
+	void invalidatePage(uint32_t page, uint32_t except);
+
+};
+
+typedef BasicTextSystem<BaseTextRendererGL2> TextSystem;
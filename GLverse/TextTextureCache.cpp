@@ -0,0 +1,98 @@
+#include "TextTextureCache.h"
+#include "BaseTextRendererGL2.h"
+#include "BaseTextRendererNull.h"
+
+
+template <typename renderer_type>
+TextTextureCache<renderer_type>& TextTextureCache<renderer_type>::instance()
+{
+	// never destroyed, texts of static lifetime release their entries at exit
+	static TextTextureCache* cache = new TextTextureCache();
+	return *cache;
+}
+
+template <typename renderer_type>
+void TextTextureCache<renderer_type>::setEnabled(bool new_enabled)
+{
+	std::lock_guard<std::mutex> lck(cache_mutex);
+	enabled = new_enabled;
+}
+
+template <typename renderer_type>
+bool TextTextureCache<renderer_type>::isEnabled()
+{
+	std::lock_guard<std::mutex> lck(cache_mutex);
+	return enabled;
+}
+
+template <typename renderer_type>
+typename TextTextureCache<renderer_type>::Usage TextTextureCache<renderer_type>::getUsage()
+{
+	std::lock_guard<std::mutex> lck(cache_mutex);
+	Usage usage;
+	usage.entries = entries.size();
+	usage.hits = hits;
+	usage.misses = misses;
+	return usage;
+}
+
+template <typename renderer_type>
+typename TextTextureCache<renderer_type>::EntryPtr TextTextureCache<renderer_type>::acquire(std::string key, std::vector<std::shared_ptr<TrueTypeFont>> fonts)
+{
+	std::lock_guard<std::mutex> lck(cache_mutex);
+	if (!enabled)
+		return nullptr;
+
+	auto&& slot = entries[key];
+	if (auto entry = slot.lock())
+	{
+		hits++;
+		return entry;
+	}
+	misses++;
+
+	auto entry = new Entry{ std::move(key), std::move(fonts), {} };
+	EntryPtr shared(entry, [this](Entry* e) { release(e); });
+	slot = shared;
+	return shared;
+}
+
+template <typename renderer_type>
+void TextTextureCache<renderer_type>::release(Entry* entry)
+{
+	{
+		std::lock_guard<std::mutex> lck(cache_mutex);
+		// the key may have been acquired again after the last user let go
+		auto it = entries.find(entry->key);
+		if (it != entries.end() && it->second.expired())
+		{
+			entries.erase(it);
+		}
+		renderer_type::deleteTexture(entry->texture.tex_id);
+	}
+	delete entry;
+}
+
+template <typename renderer_type>
+bool TextTextureCache<renderer_type>::isReady(const EntryPtr& entry)
+{
+	std::lock_guard<std::mutex> lck(cache_mutex);
+	return isResident(entry->texture);
+}
+
+template <typename renderer_type>
+GLtexture TextTextureCache<renderer_type>::getTexture(const EntryPtr& entry)
+{
+	std::lock_guard<std::mutex> lck(cache_mutex);
+	return entry->texture;
+}
+
+template <typename renderer_type>
+bool TextTextureCache<renderer_type>::isResident(const GLtexture& texture)
+{
+	return texture.tex_id != 0 && renderer_type::isTextureResident(texture.tex_id);
+}
+
+
+template class TextTextureCache<BaseTextRendererGL2>;
+template class TextTextureCache<BaseTextRendererNull>;
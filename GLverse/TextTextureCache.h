@@ -0,0 +1,80 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "OpenGL.h"
+#include "TrueTypeFont.h"
+
+
+// Textures of identical texts: one composite and one upload for all texts
+// sharing a key, i.e. everything their composite depends on (fonts, styles,
+// effects, spacing, alignment and the wrapped text). The color and the
+// position of a text are applied when drawing, so they are not part of it.
+// An entry is released together with its texture when its last user changes
+// or is destroyed; entries are acquired from any thread, their texture is
+// only uploaded and released on the render thread.
+template <typename renderer_type>
+class TextTextureCache
+{
+public:
+	struct Entry
+	{
+		std::string key;
+		// keeps the fonts whose addresses are part of the key alive
+		std::vector<std::shared_ptr<TrueTypeFont>> fonts;
+		GLtexture texture{};
+	};
+	typedef std::shared_ptr<Entry> EntryPtr;
+
+	struct Usage
+	{
+		size_t entries{};
+		uint64_t hits{};
+		uint64_t misses{};
+	};
+
+private:
+	std::mutex cache_mutex;
+	std::unordered_map<std::string, std::weak_ptr<Entry>> entries;
+	bool enabled{ true };
+	uint64_t hits{ 0 };
+	uint64_t misses{ 0 };
+
+private:
+	TextTextureCache() = default;
+	void release(Entry* entry);
+
+public:
+	static TextTextureCache& instance();
+
+public:
+	// texts acquire nothing while disabled, entries in use are kept
+	void setEnabled(bool enabled);
+	bool isEnabled();
+	Usage getUsage();
+
+public:
+	// nullptr while disabled
+	EntryPtr acquire(std::string key, std::vector<std::shared_ptr<TrueTypeFont>> fonts);
+	// false until the first user uploaded it, or after its storage was evicted
+	bool isReady(const EntryPtr& entry);
+	// upload(texture) is called unless another user was first
+	template <typename F>
+	void upload(const EntryPtr& entry, F&& upload)
+	{
+		std::lock_guard<std::mutex> lck(cache_mutex);
+		if (!isResident(entry->texture))
+		{
+			upload(entry->texture);
+		}
+	}
+	// a copy for drawing, the name changes when evicted storage is uploaded again
+	GLtexture getTexture(const EntryPtr& entry);
+
+private:
+	static bool isResident(const GLtexture& texture);
+
+};
@@ -0,0 +1,54 @@
+#include "TextWorkerPool.h"
+#include <algorithm>
+
+
+TextWorkerPool::TextWorkerPool()
+{
+	// one core is left to the render thread
+	size_t threads = std::max(2u, std::thread::hardware_concurrency()) - 1;
+	for (size_t i = 0; i < threads; ++i)
+	{
+		workers.emplace_back(&TextWorkerPool::run, this);
+	}
+}
+
+TextWorkerPool::~TextWorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lck(queue_mutex);
+		stopping = true;
+	}
+	queue_cv.notify_all();
+	for (auto&& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+TextWorkerPool& TextWorkerPool::instance()
+{
+	static TextWorkerPool pool;
+	return pool;
+}
+
+size_t TextWorkerPool::getThreadCount() const
+{
+	return workers.size();
+}
+
+void TextWorkerPool::run()
+{
+	for (;;)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lck(queue_mutex);
+			queue_cv.wait(lck, [this] { return stopping || !queue.empty(); });
+			if (queue.empty())
+				return;
+			job = std::move(queue.front());
+			queue.pop_front();
+		}
+		job();
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Shared worker threads for CPU-side text preparation (decode, wrap, layout,
+// composite). Jobs must not touch GL, uploads stay on the render thread.
+class TextWorkerPool
+{
+private:
+	std::mutex queue_mutex;
+	std::condition_variable queue_cv;
+	std::deque<std::function<void()>> queue;
+	std::vector<std::thread> workers;
+	bool stopping{ false };
+
+private:
+	TextWorkerPool();
+	void run();
+
+public:
+	~TextWorkerPool();
+	static TextWorkerPool& instance();
+
+public:
+	size_t getThreadCount() const;
+
+	template <typename F>
+	auto submit(F&& job) -> std::future<decltype(job())>
+	{
+		typedef decltype(job()) result_type;
+		auto task = std::make_shared<std::packaged_task<result_type()>>(std::forward<F>(job));
+		auto result = task->get_future();
+		{
+			std::lock_guard<std::mutex> lck(queue_mutex);
+			queue.emplace_back([task] { (*task)(); });
+		}
+		queue_cv.notify_one();
+		return result;
+	}
+
+};
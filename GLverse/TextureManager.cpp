@@ -0,0 +1,464 @@
+#include "TextureManager.h"
+#include <algorithm>
+#include <cstring>
+#include "Statistics.h"
+
+
+TextureManager& TextureManager::instance()
+{
+	static TextureManager texture_manager{};
+	return texture_manager;
+}
+
+TextureManager::SizeClass TextureManager::sizeClass(int w, int h)
+{
+	if (npot < 0)
+	{
+		npot = (GLEW_VERSION_2_0 || GLEW_ARB_texture_non_power_of_two) ? 1 : 0;
+	}
+	auto round_up = [this](int v)
+	{
+		v = std::max(v, 1);
+		if (npot)
+		{
+			return (v + 15) & ~15;
+		}
+		int p = 1;
+		while (p < v)
+		{
+			p <<= 1;
+		}
+		return p;
+	};
+	return { round_up(w), round_up(h) };
+}
+
+size_t TextureManager::storageBytes(int w, int h)
+{
+	return static_cast<size_t>(w) * h * sizeof(TVE::BGRATexel);
+}
+
+GLuint TextureManager::allocate(SizeClass size)
+{
+	auto pool = pools.find(size);
+	if (pool != pools.end() && !pool->second.empty())
+	{
+		GLuint texture = pool->second.back();
+		pool->second.pop_back();
+		pooled_bytes -= storageBytes(size.first, size.second);
+		reuses++;
+		return texture;
+	}
+
+	GLuint texture = 0;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size.first, size.second, 0, GL_BGRA, GL_UNSIGNED_BYTE, nullptr);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	allocations++;
+	return texture;
+}
+
+void TextureManager::upload(GLtexture& texture, const TexelVector& buffer)
+{
+	std::lock_guard<std::mutex> lck(manager_mutex);
+
+	int w = static_cast<int>(buffer.get_w());
+	int h = static_cast<int>(buffer.get_h());
+	auto size = sizeClass(w, h);
+
+	GLuint id = texture.tex_id;
+	GLuint replaced = 0;
+	SizeClass replaced_size;
+	auto it = textures.find(id);
+	if (it != textures.end())
+	{
+		auto&& e = it->second;
+		if (!frames_counted && e.drawn_frame == frame)
+		{
+			frame++;
+		}
+		// update in place, unless the storage is too small or way too big, or
+		// it was drawn in this frame: writing it would wait for those draws
+		bool fits = !e.evicted
+			&& e.alloc_w >= w && e.alloc_h >= h
+			&& e.alloc_w <= size.first * 2 && e.alloc_h <= size.second * 2;
+		if (fits && e.drawn_frame != frame)
+		{
+			reuses++;
+		}
+		else
+		{
+			if (e.evicted)
+			{
+				glDeleteTextures(1, &id);
+			}
+			else
+			{
+				unlink(e);
+				resident_bytes -= storageBytes(e.alloc_w, e.alloc_h);
+				replaced = id;
+				replaced_size = { e.alloc_w, e.alloc_h };
+			}
+			textures.erase(it);
+			id = 0;
+		}
+	}
+	else if (id != 0)
+	{
+		glDeleteTextures(1, &id);
+		id = 0;
+	}
+
+	if (id == 0)
+	{
+		id = allocate(size);
+		auto&& e = textures[id];
+		e.id = id;
+		e.alloc_w = size.first;
+		e.alloc_h = size.second;
+		resident_bytes += storageBytes(size.first, size.second);
+	}
+	// retired after the allocation, so it is not handed back right away
+	if (replaced != 0)
+	{
+		retire(replaced_size, replaced);
+	}
+
+	auto&& e = textures[id];
+	use(e);
+
+	glBindTexture(GL_TEXTURE_2D, id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	if (isAsync() && stage(buffer))
+	{
+		// source is the bound pixel buffer, the call returns before the transfer
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_BGRA, GL_UNSIGNED_BYTE, nullptr);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		current_frame.stats.staged_uploads++;
+	}
+	else
+	{
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_BGRA, GL_UNSIGNED_BYTE, buffer.data());
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	current_frame.stats.uploads++;
+	current_frame.stats.upload_bytes += buffer.size() * sizeof(TVE::BGRATexel);
+	current_frame.submitted.push_back(clock::now());
+
+	texture.tex_id = id;
+	texture.tex_u = static_cast<GLfloat>(w) / e.alloc_w;
+	texture.tex_v = static_cast<GLfloat>(h) / e.alloc_h;
+
+	enforceBudget(id);
+}
+
+bool TextureManager::uploadRegion(GLtexture& texture, const TexelVector& buffer, int x, int y)
+{
+	std::lock_guard<std::mutex> lck(manager_mutex);
+
+	int w = static_cast<int>(buffer.get_w());
+	int h = static_cast<int>(buffer.get_h());
+	auto it = textures.find(texture.tex_id);
+	if (it == textures.end() || it->second.evicted
+		|| x < 0 || y < 0 || x + w > it->second.alloc_w || y + h > it->second.alloc_h)
+	{
+		return false;
+	}
+
+	use(it->second);
+
+	glBindTexture(GL_TEXTURE_2D, texture.tex_id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_BGRA, GL_UNSIGNED_BYTE, buffer.data());
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return true;
+}
+
+void TextureManager::release(GLuint& texture)
+{
+	std::lock_guard<std::mutex> lck(manager_mutex);
+
+	auto it = textures.find(texture);
+	if (it == textures.end() || it->second.evicted)
+	{
+		glDeleteTextures(1, &texture);
+	}
+	else
+	{
+		auto&& e = it->second;
+		unlink(e);
+		resident_bytes -= storageBytes(e.alloc_w, e.alloc_h);
+		retire({ e.alloc_w, e.alloc_h }, texture);
+	}
+	if (it != textures.end())
+	{
+		textures.erase(it);
+	}
+	texture = 0;
+
+	enforceBudget(0);
+}
+
+void TextureManager::touch(GLuint texture)
+{
+	std::lock_guard<std::mutex> lck(manager_mutex);
+
+	auto it = textures.find(texture);
+	if (it != textures.end() && !it->second.evicted)
+	{
+		auto&& e = it->second;
+		if (!frames_counted && e.drawn_frame == frame && texture != last_drawn)
+		{
+			frame++;
+		}
+		last_drawn = texture;
+		use(e);
+		e.drawn_frame = frame;
+	}
+}
+
+bool TextureManager::isResident(GLuint texture)
+{
+	std::lock_guard<std::mutex> lck(manager_mutex);
+
+	auto it = textures.find(texture);
+	return it != textures.end() && !it->second.evicted;
+}
+
+void TextureManager::nextFrame()
+{
+	std::lock_guard<std::mutex> lck(manager_mutex);
+
+	current_frame.stats.frame = frame;
+	if (isAsync())
+	{
+		current_frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+	frames_in_flight.push_back(std::move(current_frame));
+	current_frame = FrameFence{};
+	// frames are normally done within a couple of swaps, do not let them pile up
+	collectFrames(frames_in_flight.size() > 3);
+	frame++;
+	frames_counted = true;
+}
+
+void TextureManager::setAsyncUploads(bool enabled)
+{
+	std::lock_guard<std::mutex> lck(manager_mutex);
+	async = enabled ? -1 : 0;
+}
+
+TextureManager::FrameStats TextureManager::getFrameStats()
+{
+	std::lock_guard<std::mutex> lck(manager_mutex);
+	return last_frame_stats;
+}
+
+bool TextureManager::isAsync()
+{
+	if (async < 0)
+	{
+		async = (GLEW_VERSION_3_2 || (GLEW_VERSION_2_1 && GLEW_ARB_map_buffer_range && GLEW_ARB_sync)) ? 1 : 0;
+	}
+	// retired storage is only recycled by nextFrame, so wait until frames are reported
+	return async > 0 && frames_counted;
+}
+
+bool TextureManager::stage(const TexelVector& buffer)
+{
+	// double-buffered staging; each buffer is orphaned before it is written,
+	// so a transfer still reading the old contents never blocks the copy
+	if (staging.empty())
+	{
+		staging.resize(2);
+		for (auto&& s : staging)
+		{
+			glGenBuffers(1, &s.pbo);
+		}
+	}
+	auto&& s = staging[staging_next];
+	staging_next = (staging_next + 1) % staging.size();
+
+	size_t bytes = buffer.size() * sizeof(TVE::BGRATexel);
+	s.capacity = std::max(s.capacity, bytes);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s.pbo);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, s.capacity, nullptr, GL_STREAM_DRAW);
+	void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (mapped == nullptr)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return false;
+	}
+	std::memcpy(mapped, buffer.data(), bytes);
+	if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) != GL_TRUE)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return false;
+	}
+	return true;
+}
+
+void TextureManager::retire(SizeClass size, GLuint texture)
+{
+	pooled_bytes += storageBytes(size.first, size.second);
+	if (isAsync())
+	{
+		current_frame.retired.emplace_back(size, texture);
+	}
+	else
+	{
+		pools[size].push_back(texture);
+	}
+}
+
+void TextureManager::collectFrames(bool wait)
+{
+	while (!frames_in_flight.empty())
+	{
+		auto&& f = frames_in_flight.front();
+		if (f.fence)
+		{
+			GLenum status = glClientWaitSync(f.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? GLuint64{ 100000000 } : 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED && status != GL_WAIT_FAILED)
+				break;
+			glDeleteSync(f.fence);
+		}
+
+		// latency is submit to observed completion, so it is bounded by the frame rate
+		auto done = clock::now();
+		double total_ms = 0.0;
+		for (auto submitted : f.submitted)
+		{
+			double ms = std::chrono::duration<double, std::milli>(done - submitted).count();
+			total_ms += ms;
+			f.stats.max_latency_ms = std::max(f.stats.max_latency_ms, ms);
+			Statistics::instance().add(Stat::UploadLatencyNs, static_cast<uint64_t>(ms * 1e6));
+		}
+		f.stats.latency_ms = f.submitted.empty() ? 0.0 : total_ms / f.submitted.size();
+		for (auto&& r : f.retired)
+		{
+			pools[r.first].push_back(r.second);
+		}
+		last_frame_stats = f.stats;
+		frames_in_flight.pop_front();
+		wait = false;
+	}
+}
+
+void TextureManager::setBudget(size_t bytes)
+{
+	std::lock_guard<std::mutex> lck(manager_mutex);
+	budget_bytes = bytes;
+	enforceBudget(0);
+}
+
+void TextureManager::setNonPowerOfTwo(bool allowed)
+{
+	std::lock_guard<std::mutex> lck(manager_mutex);
+	npot = allowed ? 1 : 0;
+}
+
+void TextureManager::trimPools()
+{
+	std::lock_guard<std::mutex> lck(manager_mutex);
+	for (auto&& pool : pools)
+	{
+		if (!pool.second.empty())
+		{
+			glDeleteTextures(static_cast<GLsizei>(pool.second.size()), pool.second.data());
+			pooled_bytes -= storageBytes(pool.first.first, pool.first.second) * pool.second.size();
+		}
+	}
+	pools.clear();
+}
+
+TextureManager::Usage TextureManager::getUsage()
+{
+	std::lock_guard<std::mutex> lck(manager_mutex);
+	Usage usage;
+	usage.resident_bytes = resident_bytes;
+	usage.pooled_bytes = pooled_bytes;
+	usage.budget_bytes = budget_bytes;
+	usage.textures = textures.size();
+	for (auto&& pool : pools)
+	{
+		usage.pooled_textures += pool.second.size();
+	}
+	usage.allocations = allocations;
+	usage.reuses = reuses;
+	usage.evictions = evictions;
+	return usage;
+}
+
+void TextureManager::enforceBudget(GLuint keep)
+{
+	// pooled storage goes first, largest size classes first
+	for (auto pool = pools.rbegin(); pool != pools.rend() && resident_bytes + pooled_bytes > budget_bytes; ++pool)
+	{
+		auto bytes = storageBytes(pool->first.first, pool->first.second);
+		while (!pool->second.empty() && resident_bytes + pooled_bytes > budget_bytes)
+		{
+			glDeleteTextures(1, &pool->second.back());
+			pool->second.pop_back();
+			pooled_bytes -= bytes;
+		}
+	}
+
+	// then least recently used textures from the tail of the list, that were not
+	// drawn in this frame (those are all in front of the others); their owners
+	// notice through isResident() and rebuild when drawn again
+	Entry* victim = lru_tail;
+	while (resident_bytes > budget_bytes && victim)
+	{
+		if (frame > 0 && victim->last_frame == frame)
+			break;
+		auto&& e = *victim;
+		victim = victim->lru_prev;
+		if (e.id == keep)
+			continue;
+
+		// drop the storage, but keep the name, so it cannot alias a new texture
+		glBindTexture(GL_TEXTURE_2D, e.id);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 0, 0, 0, GL_BGRA, GL_UNSIGNED_BYTE, nullptr);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		unlink(e);
+		resident_bytes -= storageBytes(e.alloc_w, e.alloc_h);
+		e.evicted = true;
+		evictions++;
+		Statistics::instance().add(Stat::TextureEvictions);
+	}
+}
+
+void TextureManager::use(Entry& e)
+{
+	e.last_frame = frame;
+	if (lru_head == &e)
+		return;
+
+	unlink(e);
+	e.lru_next = lru_head;
+	if (lru_head)
+		lru_head->lru_prev = &e;
+	lru_head = &e;
+	if (lru_tail == nullptr)
+		lru_tail = &e;
+}
+
+void TextureManager::unlink(Entry& e)
+{
+	if (e.lru_prev)
+		e.lru_prev->lru_next = e.lru_next;
+	else if (lru_head == &e)
+		lru_head = e.lru_next;
+	if (e.lru_next)
+		e.lru_next->lru_prev = e.lru_prev;
+	else if (lru_tail == &e)
+		lru_tail = e.lru_prev;
+	e.lru_prev = nullptr;
+	e.lru_next = nullptr;
+}
@@ -0,0 +1,152 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "OpenGL.h"
+#include "TexelVector.h"
+
+
+// Owns the storage of all text textures: reuses storage in place when new
+// content fits, pools released storage by size class and keeps the resident
+// size within a budget by evicting textures that were not drawn recently.
+// Evicted textures keep their name, but lose their storage (see isResident).
+//
+// When pixel buffer objects and fences are available, uploads are staged
+// through a ring of PBOs, so the render thread only copies into mapped memory
+// and the transfer overlaps with the rest of the frame. Storage replaced or
+// released in a frame is retired, not reused, until the GPU has finished that
+// frame, so no upload ever waits for draws of the previous content. For the
+// same reason a texture drawn in the current frame is not updated in place:
+// its new content goes to pooled storage and the drawn one is retired.
+//
+// Frames are counted by nextFrame, called once per frame after its draws. An
+// application that never calls it gets no staged uploads, and frames inferred
+// from its draws: a frame ends where a texture drawn in it is updated, or drawn
+// again other than right after itself (as atlas pages are).
+class TextureManager
+{
+public:
+	// uploads submitted in one frame, reported once the GPU finished that frame
+	struct FrameStats
+	{
+		uint64_t frame{};
+		uint64_t uploads{};
+		uint64_t upload_bytes{};
+		uint64_t staged_uploads{};
+		double latency_ms{};
+		double max_latency_ms{};
+	};
+
+	struct Usage
+	{
+		size_t resident_bytes{};
+		size_t pooled_bytes{};
+		size_t budget_bytes{};
+		size_t textures{};
+		size_t pooled_textures{};
+		uint64_t allocations{};
+		uint64_t reuses{};
+		uint64_t evictions{};
+	};
+
+private:
+	struct Entry
+	{
+		GLuint id{};
+		int alloc_w{};
+		int alloc_h{};
+		uint64_t last_frame{};
+		// frame of the last draw, see upload
+		uint64_t drawn_frame{ ~uint64_t{ 0 } };
+		bool evicted{ false };
+		// resident textures, most recently used first (map nodes do not move)
+		Entry* lru_prev{ nullptr };
+		Entry* lru_next{ nullptr };
+	};
+
+	typedef std::pair<int, int> SizeClass;
+	typedef std::chrono::steady_clock clock;
+
+	struct StagingBuffer
+	{
+		GLuint pbo{ 0 };
+		size_t capacity{ 0 };
+	};
+
+	struct FrameFence
+	{
+		GLsync fence{ nullptr };
+		FrameStats stats;
+		std::vector<clock::time_point> submitted;
+		std::vector<std::pair<SizeClass, GLuint>> retired;
+	};
+
+private:
+	std::mutex manager_mutex;
+	std::unordered_map<GLuint, Entry> textures;
+	std::map<SizeClass, std::vector<GLuint>> pools;
+	Entry* lru_head{ nullptr };
+	Entry* lru_tail{ nullptr };
+
+private:
+	std::vector<StagingBuffer> staging;
+	size_t staging_next{ 0 };
+	FrameFence current_frame;
+	std::deque<FrameFence> frames_in_flight;
+	FrameStats last_frame_stats;
+
+private:
+	size_t budget_bytes{ 256 << 20 };
+	size_t resident_bytes{ 0 };
+	size_t pooled_bytes{ 0 };
+	uint64_t frame{ 0 };
+	bool frames_counted{ false }; // nextFrame was called, frames are not inferred
+	GLuint last_drawn{ 0 };
+	uint64_t allocations{ 0 };
+	uint64_t reuses{ 0 };
+	uint64_t evictions{ 0 };
+	int npot{ -1 };
+	int async{ -1 };
+
+private:
+	TextureManager() = default;
+
+public:
+	static TextureManager& instance();
+
+public:
+	void upload(GLtexture& texture, const TexelVector& buffer);
+	bool uploadRegion(GLtexture& texture, const TexelVector& buffer, int x, int y);
+	void release(GLuint& texture);
+	void touch(GLuint texture);
+	bool isResident(GLuint texture);
+
+public:
+	// once per frame after its draws (e.g. at the buffer swap): fences the frame for
+	// staged uploads, recycles retired storage and reports the frame (getFrameStats)
+	void nextFrame();
+	void setBudget(size_t bytes);
+	void setNonPowerOfTwo(bool allowed);
+	void setAsyncUploads(bool enabled);
+	FrameStats getFrameStats();
+	void trimPools();
+	Usage getUsage();
+
+private:
+	SizeClass sizeClass(int w, int h);
+	static size_t storageBytes(int w, int h);
+	GLuint allocate(SizeClass size);
+	bool isAsync();
+	bool stage(const TexelVector& buffer);
+	void retire(SizeClass size, GLuint texture);
+	void collectFrames(bool wait);
+	void enforceBudget(GLuint keep);
+	void use(Entry& e);
+	void unlink(Entry& e);
+
+};
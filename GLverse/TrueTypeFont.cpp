@@ -1,57 +1,366 @@
 #include "TrueTypeFont.h"
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
 #include "TexelVector.h"
 
 
-TrueTypeFont::TrueTypeFont(FT_Face face, std::string name)
+TrueTypeFont::TrueTypeFont(FT_Face face, std::string name, TrueTypeCoveragePtr face_coverage)
 {
 	font_face = face;
 	font_size = std::make_unique<FT_SizeRec>();
 	font_size->metrics = face->size->metrics;
 	font_name = name;
+	coverage = face_coverage;
+	if (coverage == nullptr)
+	{
+		scanCoverage();
+	}
+}
+
+TrueTypeFont::TrueTypeFont(const BakedFont& baked_font, std::function<std::shared_ptr<TrueTypeFont>()> open_file):
+	open_file(std::move(open_file))
+{
+	baked = &baked_font;
+	font_size = std::make_unique<FT_SizeRec>();
+	font_size->metrics = baked_font.metrics;
+	font_name = baked_font.name;
+
+	// every glyph is in place from the start, nothing is ever loaded
+	char32_t max_c = baked_font.glyph_count ? baked_font.glyphs[baked_font.glyph_count - 1].c : 0;
+	coverage = std::make_shared<TrueTypeCoverage>();
+	auto&& bits = coverage->bits;
+	bits = std::vector<std::atomic<uint64_t>>((max_c >> 6) + 1);
+	for (size_t i = 0; i < baked_font.glyph_count; ++i)
+	{
+		auto&& g = baked_font.glyphs[i];
+		bits[g.c >> 6].fetch_or(uint64_t{ 1 } << (g.c & 63), std::memory_order_relaxed);
+		glyphs[g.c] = bakedGlyph(baked_font, g);
+		glyph_metrics[g.c] = { g.metrics, g.advance };
+	}
+}
+
+void TrueTypeFont::scanCoverage()
+{
+	FT_ULong max_c = 0;
+	FT_UInt index = 0;
+	for (FT_ULong c = FT_Get_First_Char(font_face, &index); index != 0; c = FT_Get_Next_Char(font_face, c, &index))
+	{
+		max_c = std::max(max_c, c);
+	}
+	coverage = std::make_shared<TrueTypeCoverage>();
+	auto&& bits = coverage->bits;
+	bits = std::vector<std::atomic<uint64_t>>((max_c >> 6) + 1);
+	for (FT_ULong c = FT_Get_First_Char(font_face, &index); index != 0; c = FT_Get_Next_Char(font_face, c, &index))
+	{
+		bits[c >> 6].fetch_or(uint64_t{ 1 } << (c & 63), std::memory_order_relaxed);
+	}
+}
+
+void TrueTypeFont::dropCoverage(char32_t c)
+{
+	auto&& bits = coverage->bits;
+	size_t word = c >> 6;
+	if (word < bits.size())
+	{
+		bits[word].fetch_and(~(uint64_t{ 1 } << (c & 63)), std::memory_order_relaxed);
+	}
+}
+
+TrueTypeFont* TrueTypeFont::fileFont() const
+{
+	std::call_once(file_once, [this]
+	{
+		try
+		{
+			file_font = open_file();
+		}
+		catch (const std::exception&)
+		{
+			// no font file, the baked charset is all there is
+		}
+	});
+	return file_font.get();
+}
+
+TrueTypeGlyph TrueTypeFont::copyGlyph(FT_GlyphSlot g, bool with_bitmap, bool with_outline)
+{
+	// the slot is reused by the next load, bitmap and outline are deep copies,
+	// all of them allocated through the memory resource and freed with the record
+	auto&& memory = Memory::instance();
+	auto record = static_cast<FT_GlyphSlotRec*>(memory.allocate(MemoryCategory::Glyphs, sizeof(FT_GlyphSlotRec), alignof(FT_GlyphSlotRec)));
+	std::memset(record, 0, sizeof(FT_GlyphSlotRec));
+	record->metrics = g->metrics;
+	record->advance = g->advance;
+	record->bitmap = g->bitmap;
+	record->bitmap_left = g->bitmap_left;
+	record->bitmap_top = g->bitmap_top;
+	record->outline = g->outline;
+	record->lsb_delta = g->lsb_delta;
+	record->rsb_delta = g->rsb_delta;
+
+	// e.g. the space has no bitmap at all
+	size_t bitmap_size = with_bitmap ? g->bitmap.rows * std::abs(g->bitmap.pitch) : 0;
+	record->bitmap.buffer = nullptr;
+	if (bitmap_size && g->bitmap.buffer)
+	{
+		record->bitmap.buffer = static_cast<unsigned char*>(memory.allocate(MemoryCategory::GlyphBitmaps, bitmap_size, 1));
+		std::memcpy(record->bitmap.buffer, g->bitmap.buffer, bitmap_size);
+	}
+
+	size_t points = with_outline ? g->outline.n_points : 0;
+	size_t contours = with_outline ? g->outline.n_contours : 0;
+	if (!with_outline)
+		record->outline = FT_Outline{};
+	record->outline.points = nullptr;
+	record->outline.tags = nullptr;
+	record->outline.contours = nullptr;
+	if (points)
+	{
+		record->outline.points = static_cast<FT_Vector*>(memory.allocate(MemoryCategory::GlyphOutlines, points * sizeof(FT_Vector), alignof(FT_Vector)));
+		std::memcpy(record->outline.points, g->outline.points, points * sizeof(FT_Vector));
+		record->outline.tags = static_cast<char*>(memory.allocate(MemoryCategory::GlyphOutlines, points, 1));
+		std::memcpy(record->outline.tags, g->outline.tags, points);
+	}
+	if (contours)
+	{
+		record->outline.contours = static_cast<short*>(memory.allocate(MemoryCategory::GlyphOutlines, contours * sizeof(short), alignof(short)));
+		std::memcpy(record->outline.contours, g->outline.contours, contours * sizeof(short));
+	}
+
+	return TrueTypeGlyph(record, [bitmap_size, points, contours](FT_GlyphSlotRec* r)
+	{
+		auto&& memory = Memory::instance();
+		memory.deallocate(MemoryCategory::GlyphBitmaps, r->bitmap.buffer, bitmap_size, 1);
+		memory.deallocate(MemoryCategory::GlyphOutlines, r->outline.points, points * sizeof(FT_Vector), alignof(FT_Vector));
+		memory.deallocate(MemoryCategory::GlyphOutlines, r->outline.tags, points, 1);
+		memory.deallocate(MemoryCategory::GlyphOutlines, r->outline.contours, contours * sizeof(short), alignof(short));
+		memory.deallocate(MemoryCategory::Glyphs, r, sizeof(FT_GlyphSlotRec), alignof(FT_GlyphSlotRec));
+	}, MemoryAllocator<FT_GlyphSlotRec, MemoryCategory::Glyphs>());
+}
+
+TrueTypeGlyph TrueTypeFont::bakedGlyph(const BakedFont& baked_font, const BakedGlyph& g)
+{
+	// the bitmap stays in the atlas, rows are atlas_w apart
+	auto&& memory = Memory::instance();
+	auto record = static_cast<FT_GlyphSlotRec*>(memory.allocate(MemoryCategory::Glyphs, sizeof(FT_GlyphSlotRec), alignof(FT_GlyphSlotRec)));
+	std::memset(record, 0, sizeof(FT_GlyphSlotRec));
+	record->metrics = g.metrics;
+	record->advance = g.advance;
+	record->lsb_delta = g.lsb_delta;
+	record->rsb_delta = g.rsb_delta;
+	record->bitmap_left = g.bitmap_left;
+	record->bitmap_top = g.bitmap_top;
+	record->format = FT_GLYPH_FORMAT_BITMAP;
+	record->bitmap.width = g.width;
+	record->bitmap.rows = g.rows;
+	record->bitmap.pitch = static_cast<int>(baked_font.atlas_w);
+	record->bitmap.num_grays = 256;
+	record->bitmap.pixel_mode = FT_PIXEL_MODE_GRAY;
+	if (g.width && g.rows)
+	{
+		record->bitmap.buffer = const_cast<unsigned char*>(baked_font.atlas + static_cast<size_t>(g.atlas_y) * baked_font.atlas_w + g.atlas_x);
+	}
+
+	return TrueTypeGlyph(record, [](FT_GlyphSlotRec* r)
+	{
+		Memory::instance().deallocate(MemoryCategory::Glyphs, r, sizeof(FT_GlyphSlotRec), alignof(FT_GlyphSlotRec));
+	}, MemoryAllocator<FT_GlyphSlotRec, MemoryCategory::Glyphs>());
+}
+
+// run-length tokens over the bitmap bytes, glyph coverage is mostly empty or
+// solid: 0..63 a run of 1..64 zeros, 64..127 a run of 1..64 0xff bytes,
+// 128..255 followed by 1..128 literal bytes
+TrueTypeFont::PackedGlyph TrueTypeFont::packGlyph(FT_GlyphSlot g)
+{
+	PackedGlyph packed{ g->metrics, g->advance, g->lsb_delta, g->rsb_delta, g->bitmap_left, g->bitmap_top, g->bitmap, {} };
+	packed.bitmap_format.buffer = nullptr;
+	size_t size = g->bitmap.rows * std::abs(g->bitmap.pitch);
+	if (size == 0 || g->bitmap.buffer == nullptr)
+		return packed;
+
+	const uint8_t* src = g->bitmap.buffer;
+	auto&& out = packed.bitmap;
+	out.reserve(size / 2);
+	size_t i = 0;
+	while (i < size)
+	{
+		uint8_t value = src[i];
+		if (value == 0 || value == 0xff)
+		{
+			size_t run = 1;
+			while (i + run < size && run < 64 && src[i + run] == value)
+				++run;
+			out.push_back(static_cast<uint8_t>((value ? 64 : 0) + run - 1));
+			i += run;
+			continue;
+		}
+
+		// literals end before the next run of two or more empty or solid bytes
+		size_t start = i;
+		while (i < size && i - start < 128)
+		{
+			if ((src[i] == 0 || src[i] == 0xff) && i + 1 < size && src[i + 1] == src[i])
+				break;
+			++i;
+		}
+		out.push_back(static_cast<uint8_t>(128 + (i - start) - 1));
+		out.insert(out.end(), src + start, src + i);
+	}
+	out.shrink_to_fit();
+	return packed;
+}
+
+TrueTypeGlyph TrueTypeFont::unpackGlyph(const PackedGlyph& packed)
+{
+	auto&& memory = Memory::instance();
+	auto record = static_cast<FT_GlyphSlotRec*>(memory.allocate(MemoryCategory::Glyphs, sizeof(FT_GlyphSlotRec), alignof(FT_GlyphSlotRec)));
+	std::memset(record, 0, sizeof(FT_GlyphSlotRec));
+	record->metrics = packed.metrics;
+	record->advance = packed.advance;
+	record->lsb_delta = packed.lsb_delta;
+	record->rsb_delta = packed.rsb_delta;
+	record->bitmap_left = packed.bitmap_left;
+	record->bitmap_top = packed.bitmap_top;
+	record->bitmap = packed.bitmap_format;
+
+	size_t bitmap_size = packed.bitmap.empty() ? 0 : record->bitmap.rows * std::abs(record->bitmap.pitch);
+	record->bitmap.buffer = nullptr;
+	if (bitmap_size)
+	{
+		auto dst = static_cast<unsigned char*>(memory.allocate(MemoryCategory::GlyphBitmaps, bitmap_size, 1));
+		size_t o = 0;
+		for (size_t i = 0; i < packed.bitmap.size() && o < bitmap_size;)
+		{
+			uint8_t token = packed.bitmap[i++];
+			size_t n = token < 128 ? (token & 63) + 1 : token - 128 + 1;
+			n = std::min(n, bitmap_size - o);
+			if (token < 128)
+				std::memset(dst + o, token < 64 ? 0 : 0xff, n);
+			else
+			{
+				std::memcpy(dst + o, &packed.bitmap[i], n);
+				i += n;
+			}
+			o += n;
+		}
+		record->bitmap.buffer = dst;
+	}
+
+	return TrueTypeGlyph(record, [bitmap_size](FT_GlyphSlotRec* r)
+	{
+		auto&& memory = Memory::instance();
+		memory.deallocate(MemoryCategory::GlyphBitmaps, r->bitmap.buffer, bitmap_size, 1);
+		memory.deallocate(MemoryCategory::Glyphs, r, sizeof(FT_GlyphSlotRec), alignof(FT_GlyphSlotRec));
+	}, MemoryAllocator<FT_GlyphSlotRec, MemoryCategory::Glyphs>());
+}
+
+void TrueTypeFont::storeHot(char32_t c, TrueTypeGlyph glyph)
+{
+	hot_order.push_front(c);
+	hot_glyphs[c] = { std::move(glyph), hot_order.begin() };
+	while (hot_glyphs.size() > hot_capacity)
+	{
+		// callers drawing the glyph keep their own reference
+		hot_glyphs.erase(hot_order.back());
+		hot_order.pop_back();
+		Statistics::instance().add(Stat::GlyphEvictions);
+	}
+}
+
+void TrueTypeFont::setCompactStorage(bool enabled, size_t hot_count)
+{
+	StatisticsLock<std::mutex> lck(font_mutex, Stat::FontLockWaits, Stat::FontLockWaitNs);
+	if (baked)
+		return;
+	hot_capacity = std::max<size_t>(hot_count, 1);
+	if (enabled == compact)
+	{
+		while (hot_glyphs.size() > hot_capacity)
+		{
+			hot_glyphs.erase(hot_order.back());
+			hot_order.pop_back();
+		}
+		return;
+	}
+
+	// glyphs are loaded again into the new storage, metrics and masks stay
+	compact = enabled;
+	glyphs.clear();
+	packed_glyphs.clear();
+	hot_glyphs.clear();
+	hot_order.clear();
+	outline_glyphs.clear();
+}
+
+bool TrueTypeFont::isCompactStorage()
+{
+	StatisticsLock<std::mutex> lck(font_mutex, Stat::FontLockWaits, Stat::FontLockWaitNs);
+	return compact;
 }
 
 TrueTypeGlyph TrueTypeFont::getGlyphSlot(char32_t c)
 {
-	std::lock_guard<std::mutex> lck(font_mutex);
-	if (glyphs.count(c))
+	if (auto file = fileFontFor(c))
+	{
+		return file->getGlyphSlot(c);
+	}
+	if (!hasGlyph(c))
+	{
+		return nullptr;
+	}
+
+	StatisticsLock<std::mutex> lck(font_mutex, Stat::FontLockWaits, Stat::FontLockWaitNs);
+	if (compact)
+	{
+		auto hot = hot_glyphs.find(c);
+		if (hot != hot_glyphs.end())
+		{
+			Statistics::instance().add(Stat::GlyphHits);
+			hot_order.splice(hot_order.begin(), hot_order, hot->second.order);
+			return hot->second.glyph;
+		}
+		auto packed = packed_glyphs.find(c);
+		if (packed != packed_glyphs.end())
+		{
+			Statistics::instance().add(Stat::GlyphHits);
+			Statistics::instance().add(Stat::GlyphUnpacks);
+			ScopedStatTimer timer(Stat::GlyphUnpackNs);
+			auto glyph = unpackGlyph(packed->second);
+			storeHot(c, glyph);
+			return glyph;
+		}
+	}
+	else
 	{
-		return glyphs[c];
+		auto it = glyphs.find(c);
+		if (it != glyphs.end())
+		{
+			Statistics::instance().add(Stat::GlyphHits);
+			return it->second;
+		}
 	}
+	Statistics::instance().add(Stat::GlyphMisses);
 
+	TraceSpan span("FT_Load_Char");
+	ScopedStatTimer timer(Stat::GlyphLoadNs);
 	if (FT_Load_Char(font_face, c, FT_LOAD_RENDER | FT_LOAD_TARGET_LIGHT))
 	{
+		dropCoverage(c);
 		return nullptr;
 	}
 
 	auto g = font_face->glyph;
-	glyphs[c] = std::make_shared<FT_GlyphSlotRec>();
-	glyphs[c]->metrics = g->metrics;
-	glyphs[c]->advance = g->advance;
-	glyphs[c]->bitmap = g->bitmap;
-	glyphs[c]->bitmap_left = g->bitmap_left;
-	glyphs[c]->bitmap_top = g->bitmap_top;
-	glyphs[c]->outline = g->outline;
-	glyphs[c]->lsb_delta = g->lsb_delta;
-	glyphs[c]->rsb_delta = g->rsb_delta;
-
-	//deepcopy(glyphs[c]->bitmap)
-	size_t bitmap_buffer_size = g->bitmap.rows * std::abs(g->bitmap.pitch);
-	glyphs[c]->bitmap.buffer = new uint8_t[bitmap_buffer_size];
-	std::memcpy(glyphs[c]->bitmap.buffer, g->bitmap.buffer, bitmap_buffer_size);
-
-	//deepcopy(glyphs[c]->outline)
-	size_t outline_points_size = g->outline.n_points;
-	glyphs[c]->outline.points = new FT_Vector[outline_points_size];
-	std::memcpy(glyphs[c]->outline.points, g->outline.points, outline_points_size * sizeof(FT_Vector));
-	size_t outline_tags_size = g->outline.n_points;
-	glyphs[c]->outline.tags = new char[outline_tags_size];
-	std::memcpy(glyphs[c]->outline.tags, g->outline.tags, outline_tags_size * sizeof(char));
-	size_t outline_contours_size = g->outline.n_contours;
-	glyphs[c]->outline.contours = new short[outline_contours_size];
-	std::memcpy(glyphs[c]->outline.contours, g->outline.contours, outline_contours_size * sizeof(short));
+	glyph_metrics[c] = { g->metrics, g->advance };
+	if (compact)
+	{
+		auto&& packed = packed_glyphs[c] = packGlyph(g);
+		auto glyph = unpackGlyph(packed);
+		storeHot(c, glyph);
+		return glyph;
+	}
+	glyphs[c] = copyGlyph(g);
 
 	// int tex_w = g->bitmap.width;
 	// int tex_h = g->bitmap.rows;
@@ -81,6 +390,223 @@ TrueTypeGlyph TrueTypeFont::getGlyphSlot(char32_t c)
 	return glyphs[c];
 }
 
+const TrueTypeGlyphMetrics* TrueTypeFont::getGlyphMetrics(char32_t c)
+{
+	// metrics tier: filled without rendering, so measuring and wrapping
+	// never produces (and caches) bitmaps of glyphs that are not drawn
+	if (auto file = fileFontFor(c))
+	{
+		return file->getGlyphMetrics(c);
+	}
+	if (!hasGlyph(c))
+	{
+		return nullptr;
+	}
+
+	StatisticsLock<std::mutex> lck(font_mutex, Stat::FontLockWaits, Stat::FontLockWaitNs);
+	uint64_t misses = 0;
+	auto m = findGlyphMetrics(c, misses);
+	Statistics::instance().add(misses ? Stat::MetricsMisses : Stat::MetricsHits);
+	return m;
+}
+
+void TrueTypeFont::getGlyphMetrics(const char32_t* cs, size_t count, const TrueTypeGlyphMetrics** metrics)
+{
+	StatisticsLock<std::mutex> lck(font_mutex, Stat::FontLockWaits, Stat::FontLockWaitNs);
+	uint64_t misses = 0;
+	uint64_t hits = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (auto file = fileFontFor(cs[i]))
+		{
+			metrics[i] = file->getGlyphMetrics(cs[i]);
+			continue;
+		}
+		if (!hasGlyph(cs[i]))
+		{
+			metrics[i] = nullptr;
+			continue;
+		}
+		uint64_t before = misses;
+		metrics[i] = findGlyphMetrics(cs[i], misses);
+		hits += misses == before;
+	}
+	Statistics::instance().add(Stat::MetricsHits, hits);
+	Statistics::instance().add(Stat::MetricsMisses, misses);
+}
+
+const TrueTypeGlyphMetrics* TrueTypeFont::findGlyphMetrics(char32_t c, uint64_t& misses)
+{
+	auto it = glyph_metrics.find(c);
+	if (it != glyph_metrics.end())
+	{
+		return &it->second;
+	}
+	misses++;
+
+	TraceSpan span("FT_Load_Char(metrics)");
+	ScopedStatTimer timer(Stat::GlyphLoadNs);
+	// same hinting as the bitmap tier, so advances and bearings are identical
+	if (FT_Load_Char(font_face, c, FT_LOAD_TARGET_LIGHT))
+	{
+		dropCoverage(c);
+		return nullptr;
+	}
+
+	auto g = font_face->glyph;
+	return &(glyph_metrics[c] = { g->metrics, g->advance });
+}
+
+// separable passes over 8-bit coverage: the vertical ones run along whole rows,
+// so their inner loops vectorize; the horizontal box pass is a running sum
+static void blurRows(CoverageVector& plane, int w, int h, int r)
+{
+	CoverageVector out(plane.size());
+	unsigned window = 2 * r + 1;
+	for (int y = 0; y < h; ++y)
+	{
+		const uint8_t* src = &plane[static_cast<size_t>(y) * w];
+		uint8_t* dst = &out[static_cast<size_t>(y) * w];
+		unsigned sum = 0;
+		for (int x = 0; x < std::min(r, w); ++x)
+			sum += src[x];
+		for (int x = 0; x < w; ++x)
+		{
+			if (x + r < w)
+				sum += src[x + r];
+			dst[x] = static_cast<uint8_t>(sum / window);
+			if (x - r >= 0)
+				sum -= src[x - r];
+		}
+	}
+	plane.swap(out);
+}
+
+static void blurColumns(CoverageVector& plane, int w, int h, int r)
+{
+	CoverageVector out(plane.size());
+	std::vector<unsigned> sum(w, 0);
+	unsigned window = 2 * r + 1;
+	auto row = [&](int y) { return &plane[static_cast<size_t>(y) * w]; };
+	for (int y = 0; y < std::min(r, h); ++y)
+	{
+		const uint8_t* src = row(y);
+		for (int x = 0; x < w; ++x)
+			sum[x] += src[x];
+	}
+	for (int y = 0; y < h; ++y)
+	{
+		if (y + r < h)
+		{
+			const uint8_t* add = row(y + r);
+			for (int x = 0; x < w; ++x)
+				sum[x] += add[x];
+		}
+		uint8_t* dst = &out[static_cast<size_t>(y) * w];
+		for (int x = 0; x < w; ++x)
+			dst[x] = static_cast<uint8_t>(sum[x] / window);
+		if (y - r >= 0)
+		{
+			const uint8_t* sub = row(y - r);
+			for (int x = 0; x < w; ++x)
+				sum[x] -= sub[x];
+		}
+	}
+	plane.swap(out);
+}
+
+static void dilateRows(CoverageVector& plane, int w, int h, int r)
+{
+	CoverageVector out(plane.size(), 0);
+	for (int y = 0; y < h; ++y)
+	{
+		const uint8_t* src = &plane[static_cast<size_t>(y) * w];
+		uint8_t* dst = &out[static_cast<size_t>(y) * w];
+		for (int d = -r; d <= r; ++d)
+		{
+			int x0 = std::max(0, -d);
+			int x1 = std::min(w, w - d);
+			for (int x = x0; x < x1; ++x)
+				dst[x] = std::max(dst[x], src[x + d]);
+		}
+	}
+	plane.swap(out);
+}
+
+static void dilateColumns(CoverageVector& plane, int w, int h, int r)
+{
+	CoverageVector out(plane.size(), 0);
+	for (int y = 0; y < h; ++y)
+	{
+		uint8_t* dst = &out[static_cast<size_t>(y) * w];
+		for (int d = std::max(-r, -y); d <= r && y + d < h; ++d)
+		{
+			const uint8_t* src = &plane[static_cast<size_t>(y + d) * w];
+			for (int x = 0; x < w; ++x)
+				dst[x] = std::max(dst[x], src[x]);
+		}
+	}
+	plane.swap(out);
+}
+
+TrueTypeGlyphMaskPtr TrueTypeFont::getGlyphMask(char32_t c, TrueTypeGlyphEffect effect, int radius)
+{
+	radius = std::min(std::max(radius, 0), 64);
+	uint64_t key = uint64_t{ c } | static_cast<uint64_t>(effect) << 32 | static_cast<uint64_t>(radius) << 40;
+	{
+		StatisticsLock<std::mutex> lck(font_mutex, Stat::FontLockWaits, Stat::FontLockWaitNs);
+		auto it = glyph_masks.find(key);
+		if (it != glyph_masks.end())
+		{
+			Statistics::instance().add(Stat::MaskHits);
+			return it->second;
+		}
+	}
+
+	auto g = getGlyphSlot(c);
+	if (g == nullptr)
+	{
+		return nullptr;
+	}
+	Statistics::instance().add(Stat::MaskMisses);
+	TraceSpan span("getGlyphMask");
+	ScopedStatTimer timer(Stat::MaskNs);
+
+	int pad = effect == TrueTypeGlyphEffect::Blur ? 2 * radius
+		: effect == TrueTypeGlyphEffect::Glow ? 3 * radius : radius;
+	auto mask = std::make_shared<TrueTypeGlyphMask>();
+	mask->left = -pad;
+	mask->top = -pad;
+	mask->width = static_cast<int>(g->bitmap.width) + 2 * pad;
+	mask->rows = static_cast<int>(g->bitmap.rows) + 2 * pad;
+	mask->coverage.assign(static_cast<size_t>(mask->width) * mask->rows, 0);
+	for (int y = 0; y < static_cast<int>(g->bitmap.rows); ++y)
+	{
+		std::memcpy(&mask->coverage[static_cast<size_t>(y + pad) * mask->width + pad],
+			g->bitmap.buffer + g->bitmap.pitch * y, g->bitmap.width);
+	}
+
+	int w = mask->width;
+	int h = mask->rows;
+	if (radius > 0 && effect != TrueTypeGlyphEffect::Blur)
+	{
+		dilateRows(mask->coverage, w, h, radius);
+		dilateColumns(mask->coverage, w, h, radius);
+	}
+	if (radius > 0 && effect != TrueTypeGlyphEffect::Dilate)
+	{
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			blurRows(mask->coverage, w, h, radius);
+			blurColumns(mask->coverage, w, h, radius);
+		}
+	}
+
+	StatisticsLock<std::mutex> lck(font_mutex, Stat::FontLockWaits, Stat::FontLockWaitNs);
+	// a concurrent miss may have won the race, both results are equal
+	return glyph_masks.emplace(key, std::move(mask)).first->second;
+}
+
 // TrueTypeGlyphEx TrueTypeFont::getGlyphSlotEx(char32_t c)
 // {
 // 	std::lock_guard<std::mutex> lck(font_mutex);
@@ -98,29 +624,107 @@ TrueTypeGlyph TrueTypeFont::getGlyphSlot(char32_t c)
 
 FT_Outline* TrueTypeFont::getGlyphOutline(char32_t c)
 {
-	return &getGlyphSlot(c)->outline;
+	if (baked)
+	{
+		// baked glyphs have bitmaps only
+		auto file = open_file ? fileFont() : nullptr;
+		return file ? file->getGlyphOutline(c) : nullptr;
+	}
+	auto g = getGlyphSlot(c);
+	StatisticsLock<std::mutex> lck(font_mutex, Stat::FontLockWaits, Stat::FontLockWaitNs);
+	if (compact && g)
+	{
+		// loaded with the hinting of the bitmap and kept, the pointer stays valid
+		auto it = outline_glyphs.find(c);
+		if (it != outline_glyphs.end())
+			return &it->second->outline;
+		if (FT_Load_Char(font_face, c, FT_LOAD_NO_BITMAP | FT_LOAD_TARGET_LIGHT))
+			return nullptr;
+		auto&& outline_glyph = outline_glyphs[c] = copyGlyph(font_face->glyph, false);
+		return &outline_glyph->outline;
+	}
+	return g ? &g->outline : nullptr;
 }
 
 std::string TrueTypeFont::getFontName()
 {
-	std::lock_guard<std::mutex> lck(font_mutex);
+	StatisticsLock<std::mutex> lck(font_mutex, Stat::FontLockWaits, Stat::FontLockWaitNs);
 	return font_name;
 }
 
 FT_Pos TrueTypeFont::getFontHeight()
 {
-	std::lock_guard<std::mutex> lck(font_mutex);
+	StatisticsLock<std::mutex> lck(font_mutex, Stat::FontLockWaits, Stat::FontLockWaitNs);
 	return font_size->metrics.height;
 }
 
+FT_Pos TrueTypeFont::getAscender()
+{
+	StatisticsLock<std::mutex> lck(font_mutex, Stat::FontLockWaits, Stat::FontLockWaitNs);
+	return font_size->metrics.ascender;
+}
+
+FT_UInt TrueTypeFont::getPixelSize()
+{
+	StatisticsLock<std::mutex> lck(font_mutex, Stat::FontLockWaits, Stat::FontLockWaitNs);
+	return font_size->metrics.y_ppem;
+}
+
 FT_Pos TrueTypeFont::getXHeight()
 {
-	return getGlyphSlot('x')->metrics.height;
+	auto m = getGlyphMetrics('x');
+	return m ? m->metrics.height : 0;
 }
 
 FT_Vector TrueTypeFont::getFontKerning(char32_t left, char32_t right)
 {
-	std::lock_guard<std::mutex> lck(font_mutex);
+	StatisticsLock<std::mutex> lck(font_mutex, Stat::FontLockWaits, Stat::FontLockWaitNs);
+	Statistics::instance().add(Stat::KerningLookups);
+	return findKerning(left, right);
+}
+
+void TrueTypeFont::getFontKerning(const char32_t* left, const char32_t* right, size_t count, FT_Pos* kerning)
+{
+	StatisticsLock<std::mutex> lck(font_mutex, Stat::FontLockWaits, Stat::FontLockWaitNs);
+	Statistics::instance().add(Stat::KerningLookups, count);
+	if (!baked && !FT_HAS_KERNING(font_face))
+	{
+		std::fill(kerning, kerning + count, 0);
+		return;
+	}
+	for (size_t i = 0; i < count; ++i)
+	{
+		kerning[i] = findKerning(left[i], right[i]).x;
+	}
+}
+
+bool TrueTypeFont::hasKerning() const
+{
+	if (baked)
+		return baked->kerning_count > 0 || open_file;
+	return FT_HAS_KERNING(font_face);
+}
+
+FT_Vector TrueTypeFont::findKerning(char32_t left, char32_t right)
+{
+	if (baked && (!isCovered(left) || !isCovered(right)))
+	{
+		auto file = fileFontFor(isCovered(left) ? right : left);
+		return file ? file->getFontKerning(left, right) : FT_Vector{ 0, 0 };
+	}
+	if (baked)
+	{
+		auto pairs = baked->kerning;
+		auto end = pairs + baked->kerning_count;
+		auto pair = std::lower_bound(pairs, end, std::make_pair(left, right), [](const BakedKerning& k, std::pair<char32_t, char32_t> p)
+		{
+			return k.left < p.first || (k.left == p.first && k.right < p.second);
+		});
+		if (pair != end && pair->left == left && pair->right == right)
+			return pair->kerning;
+		return FT_Vector{ 0, 0 };
+	}
+
 	auto prev = FT_Get_Char_Index(font_face, left);
 	auto next = FT_Get_Char_Index(font_face, right);
 
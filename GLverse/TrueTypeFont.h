@@ -1,21 +1,22 @@
 #pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
+#include "BakedFont.h"
+#include "MemoryResource.h"
 #include "OpenGL.h"
+#include "Statistics.h"
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include FT_OUTLINE_H
-// #define GLYPH_SHADOWS 31
 
 
-struct GLtexture
-{
-	GLuint tex_id{ 0 };
-	int tex_w{ 0 };
-	int tex_h{ 0 };
-};
 // struct GlyphSlotRecEx
 // {
 // 	GLtexture texture;
@@ -23,6 +24,43 @@ struct GLtexture
 // typedef std::shared_ptr<GlyphSlotRecEx> TrueTypeGlyphEx;
 typedef std::shared_ptr<FT_GlyphSlotRec> TrueTypeGlyph;
 
+// layout-only view of a glyph, available without rasterizing it
+struct TrueTypeGlyphMetrics
+{
+	FT_Glyph_Metrics metrics;
+	FT_Vector advance;
+};
+
+
+// cmap coverage of a face, one bit per codepoint: scanned once per face and
+// shared by the fonts of all its sizes
+struct TrueTypeCoverage
+{
+	std::vector<std::atomic<uint64_t>> bits;
+};
+typedef std::shared_ptr<TrueTypeCoverage> TrueTypeCoveragePtr;
+
+
+// coverage masks derived from the glyph bitmap, for text effects
+enum class TrueTypeGlyphEffect
+{
+	Blur, // two box passes (a triangle filter), grows by 2 * radius
+	Dilate, // square max filter, grows by radius
+	Glow, // dilated, then blurred, grows by 3 * radius
+};
+
+typedef std::vector<uint8_t, MemoryAllocator<uint8_t, MemoryCategory::Coverage>> CoverageVector;
+
+struct TrueTypeGlyphMask
+{
+	int left{ 0 }; // relative to the glyph bitmap
+	int top{ 0 };
+	int width{ 0 };
+	int rows{ 0 };
+	CoverageVector coverage;
+};
+typedef std::shared_ptr<const TrueTypeGlyphMask> TrueTypeGlyphMaskPtr;
+
 
 class TrueTypeFont
 {
@@ -33,21 +71,120 @@ private:
 	std::string font_name;
 
 private:
-	FT_Face font_face;
+	FT_Face font_face{ nullptr };
 	std::unique_ptr<FT_SizeRec> font_size;
+	const BakedFont* baked{ nullptr }; // no face, every glyph of its charset is baked
+
+private:
+	// the rest of the charset of a baked font comes from its font file, opened on first use
+	std::function<std::shared_ptr<TrueTypeFont>()> open_file;
+	mutable std::once_flag file_once;
+	mutable std::shared_ptr<TrueTypeFont> file_font;
+
+private:
+	// bits of glyphs that fail to load are cleared, so misses are never looked up again
+	TrueTypeCoveragePtr coverage;
 
 private:
 	std::unordered_map<char32_t, TrueTypeGlyph> glyphs;
+	std::unordered_map<char32_t, TrueTypeGlyphMetrics> glyph_metrics;
+	std::unordered_map<uint64_t, TrueTypeGlyphMaskPtr> glyph_masks;
+
+private:
+	typedef std::vector<uint8_t, MemoryAllocator<uint8_t, MemoryCategory::GlyphPacked>> PackedBitmap;
+	typedef std::list<char32_t, MemoryAllocator<char32_t, MemoryCategory::Glyphs>> HotOrder;
+
+	// compact storage: every glyph is kept with its bitmap run-length encoded,
+	// only the most recently used ones are also kept decoded; outlines are not
+	// kept, getGlyphOutline loads them again from the face
+	struct PackedGlyph
+	{
+		FT_Glyph_Metrics metrics;
+		FT_Vector advance;
+		FT_Pos lsb_delta;
+		FT_Pos rsb_delta;
+		FT_Int bitmap_left;
+		FT_Int bitmap_top;
+		FT_Bitmap bitmap_format; // without buffer
+		PackedBitmap bitmap;
+	};
+
+	struct HotGlyph
+	{
+		TrueTypeGlyph glyph;
+		HotOrder::iterator order;
+	};
+
+	bool compact{ false };
+	size_t hot_capacity{ 256 };
+	std::unordered_map<char32_t, PackedGlyph> packed_glyphs;
+	std::unordered_map<char32_t, HotGlyph> hot_glyphs;
+	HotOrder hot_order; // most recently used first
+	std::unordered_map<char32_t, TrueTypeGlyph> outline_glyphs; // asked for by getGlyphOutline
 	//std::unordered_map<char32_t, TrueTypeGlyphEx> glyphs_ex;
 
 public:
 	// TrueTypeFont(){}
-	TrueTypeFont(FT_Face face, std::string name);
+	// the coverage of another size of the same face is reused, not scanned again
+	TrueTypeFont(FT_Face face, std::string name, TrueTypeCoveragePtr face_coverage = nullptr);
+	// serves the glyphs of a generated header, the data has to outlive the font;
+	// other characters are served by the font open_file returns, if any
+	explicit TrueTypeFont(const BakedFont& baked_font, std::function<std::shared_ptr<TrueTypeFont>()> open_file = nullptr);
 	TrueTypeFont(const TrueTypeFont& other) = delete;
 	TrueTypeFont(TrueTypeFont&& other) = delete;
 
+private:
+	void scanCoverage();
+	void dropCoverage(char32_t c);
+	TrueTypeFont* fileFont() const;
+	// the font file for characters a baked font does not have, nullptr otherwise
+	TrueTypeFont* fileFontFor(char32_t c) const
+	{
+		return baked && open_file && !isCovered(c) ? fileFont() : nullptr;
+	}
+	bool isCovered(char32_t c) const
+	{
+		auto&& bits = coverage->bits;
+		size_t word = c >> 6;
+		return word < bits.size() && (bits[word].load(std::memory_order_relaxed) >> (c & 63) & 1);
+	}
+	static TrueTypeGlyph copyGlyph(FT_GlyphSlot g, bool with_bitmap = true, bool with_outline = true);
+	static TrueTypeGlyph bakedGlyph(const BakedFont& baked_font, const BakedGlyph& g);
+	static PackedGlyph packGlyph(FT_GlyphSlot g);
+	static TrueTypeGlyph unpackGlyph(const PackedGlyph& packed);
+	void storeHot(char32_t c, TrueTypeGlyph glyph);
+	// font_mutex held
+	const TrueTypeGlyphMetrics* findGlyphMetrics(char32_t c, uint64_t& misses);
+	FT_Vector findKerning(char32_t left, char32_t right);
+
+public:
+	bool hasGlyph(char32_t c) const
+	{
+		if (isCovered(c))
+			return true;
+		auto file = fileFontFor(c);
+		return file && file->hasGlyph(c);
+	}
+
+	TrueTypeCoveragePtr getCoverage() const
+	{
+		return coverage;
+	}
+
+public:
+	// for fonts with large charsets (e.g. CJK): bitmaps are kept compressed and
+	// decoded on demand into a cache of hot_count glyphs; glyphs cached so far are dropped
+	// (baked fonts keep their bitmaps in the atlas, they ignore it)
+	void setCompactStorage(bool enabled, size_t hot_count = 256);
+	bool isCompactStorage();
+
 public:
 	TrueTypeGlyph getGlyphSlot(char32_t c);
+	const TrueTypeGlyphMetrics* getGlyphMetrics(char32_t c);
+	// the metrics of count characters under one lock, nullptr for missing glyphs
+	void getGlyphMetrics(const char32_t* cs, size_t count, const TrueTypeGlyphMetrics** metrics);
+	// computed once per glyph, effect and radius, then served from the cache
+	TrueTypeGlyphMaskPtr getGlyphMask(char32_t c, TrueTypeGlyphEffect effect, int radius);
 	//TrueTypeGlyphEx getGlyphSlotEx(char32_t c);
 	//GLuint getGlyphTexture(char32_t c);
 	FT_Outline* getGlyphOutline(char32_t c);
@@ -55,8 +192,14 @@ public:
 public:
 	std::string getFontName();
 	FT_Pos getFontHeight();
+	FT_Pos getAscender();
+	FT_UInt getPixelSize();
 	FT_Pos getXHeight();
 
 	FT_Vector getFontKerning(char32_t prev, char32_t next);
+	// horizontal kerning of the pairs (left[i], right[i]) under one lock
+	void getFontKerning(const char32_t* left, const char32_t* right, size_t count, FT_Pos* kerning);
+	// false when every pair kerns to 0
+	bool hasKerning() const;
 
 };
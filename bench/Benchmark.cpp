@@ -0,0 +1,49 @@
+#include "Benchmark.h"
+#include <cstdio>
+
+
+volatile uint64_t Benchmark::sink{ 0 };
+
+Benchmark::Benchmark(size_t repetitions, std::string filter):
+	filter{ filter },
+	repetitions{ std::max<size_t>(repetitions, 1) }
+{
+}
+
+void Benchmark::setBytesPerOp(double bytes)
+{
+	if (!results.empty())
+		results.back().bytes_per_op = bytes;
+}
+
+void Benchmark::writeJson(std::ostream& os) const
+{
+	// fixed key order and number formatting, so that outputs diff cleanly
+	char number[64];
+	os << "{\n";
+	os << "\t\"version\": 1,\n";
+	os << "\t\"repetitions\": " << repetitions << ",\n";
+	os << "\t\"benchmarks\": [\n";
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		auto&& r = results[i];
+		os << "\t\t{ ";
+		os << "\"name\": \"" << r.name << "\", ";
+		os << "\"corpus\": \"" << r.corpus << "\", ";
+		os << "\"ops\": " << r.ops << ", ";
+		std::snprintf(number, sizeof(number), "%.3f", r.ns_per_op);
+		os << "\"ns_per_op\": " << number << ", ";
+		std::snprintf(number, sizeof(number), "%.3f", r.min_ns_per_op);
+		os << "\"min_ns_per_op\": " << number << ", ";
+		std::snprintf(number, sizeof(number), "%.1f", r.ns_per_op > 0 ? 1e9 / r.ns_per_op : 0.0);
+		os << "\"ops_per_s\": " << number;
+		if (r.bytes_per_op >= 0)
+		{
+			std::snprintf(number, sizeof(number), "%.1f", r.bytes_per_op);
+			os << ", \"bytes_per_op\": " << number;
+		}
+		os << (i + 1 < results.size() ? " },\n" : " }\n");
+	}
+	os << "\t]\n";
+	os << "}\n";
+}
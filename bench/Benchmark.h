@@ -0,0 +1,81 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+class Benchmark
+{
+public:
+	struct Result
+	{
+		std::string name;
+		std::string corpus;
+		size_t ops{};
+		double ns_per_op{};
+		double min_ns_per_op{};
+		double bytes_per_op{ -1 }; // reported only when measured
+	};
+
+private:
+	typedef std::chrono::steady_clock clock;
+
+private:
+	std::vector<Result> results;
+	std::string filter;
+	size_t repetitions{ 5 };
+
+public:
+	static volatile uint64_t sink;
+
+public:
+	Benchmark(size_t repetitions, std::string filter);
+
+public:
+	// setup() and teardown() run outside of the timed region, the result of setup()
+	// is passed to f(), which has to perform `ops` operations, and then to teardown();
+	// the reported time is the median
+	template <typename Setup, typename F, typename Teardown>
+	void run(std::string name, std::string corpus, size_t ops, Setup&& setup, F&& f, Teardown&& teardown)
+	{
+		if (!filter.empty() && (name + "/" + corpus).find(filter) == std::string::npos)
+			return;
+
+		std::vector<double> samples;
+		for (size_t i = 0; i < repetitions; ++i)
+		{
+			auto state = setup();
+			auto start = clock::now();
+			f(state);
+			auto stop = clock::now();
+			teardown(state);
+			std::chrono::duration<double, std::nano> elapsed = stop - start;
+			samples.push_back(elapsed.count() / std::max<size_t>(ops, 1));
+		}
+		std::sort(samples.begin(), samples.end());
+		results.push_back({ name, corpus, ops, samples[samples.size() / 2], samples.front() });
+	}
+
+	template <typename Setup, typename F>
+	void run(std::string name, std::string corpus, size_t ops, Setup&& setup, F&& f)
+	{
+		run(name, corpus, ops, std::forward<Setup>(setup), std::forward<F>(f), [](auto&) {});
+	}
+
+	template <typename F>
+	void run(std::string name, std::string corpus, size_t ops, F&& f)
+	{
+		run(name, corpus, ops, [] { return 0; }, [&](int) { f(); });
+	}
+
+	// memory held per operation by the last run, e.g. bytes per cached glyph
+	void setBytesPerOp(double bytes);
+
+public:
+	void writeJson(std::ostream& os) const;
+
+};
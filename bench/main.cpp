@@ -0,0 +1,418 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Benchmark.h"
+#include "FontRepository.h"
+#include "BaseTextRendererNull.h"
+#include "LazyText.h"
+#include "TextSystem.h"
+#include "NotoSans_Regular_24.h"
+
+
+class BenchText : public BaseText<std::u32string>
+{
+public:
+	using BaseText::BaseText;
+};
+
+struct Corpus
+{
+	std::string name;
+	std::string text;
+};
+
+static std::vector<Corpus> makeCorpora()
+{
+	std::string ascii = "The quick brown fox jumps over the lazy dog. 0123456789 (AV, To, Wa, Yo)!";
+
+	std::string latin_ext = u8"Zażółć gęślą jaźń. Příliš žluťoučký kůň úpěl ďábelské ódy. "
+		u8"Árvíztűrő tükörfúrógép. Œuvre, façade, naïve, smørrebrød, Ærøskøbing.";
+
+	std::string paragraph;
+	std::string lorem = "Lorem ipsum dolor sit amet, consectetur adipisicing elit, "
+		"sed do eiusmod tempor incididunt ut labore et dolore magna aliqua. "
+		"Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris "
+		"nisi ut aliquip ex ea commodo consequat.";
+	for (int i = 0; i < 32; ++i)
+	{
+		paragraph += lorem;
+		paragraph += (i % 4 == 3) ? "\n" : " ";
+	}
+	paragraph += lorem;
+
+	return {
+		{ "ascii", ascii },
+		{ "latin_ext", latin_ext },
+		{ "paragraph", paragraph },
+	};
+}
+
+// a font of its own, nothing cached yet: every first lookup misses
+typedef std::pair<FT_Face, std::shared_ptr<TrueTypeFont>> FreshFont;
+
+static FreshFont openFreshFont(FT_Library ft, const std::string& font_name, int size)
+{
+	auto font_path = "fonts/" + font_name + ".ttf";
+	FT_Face face;
+	if (FT_New_Face(ft, font_path.c_str(), 0, &face))
+	{
+		std::cerr << "missing font: " << font_path << "\n";
+		std::exit(1);
+	}
+	FT_Set_Pixel_Sizes(face, 0, size);
+	return { face, std::make_shared<TrueTypeFont>(face, font_name) };
+}
+
+static void closeFreshFont(FreshFont& fresh)
+{
+	fresh.second.reset();
+	FT_Done_Face(fresh.first);
+}
+
+int main(int argc, char **argv)
+{
+	size_t repetitions = 5;
+	std::string filter;
+	std::string font_name = "NotoSans-Regular";
+	int font_size = 24;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!std::strcmp(argv[i], "--repetitions") && i + 1 < argc)
+			repetitions = std::atoi(argv[++i]);
+		else if (!std::strcmp(argv[i], "--filter") && i + 1 < argc)
+			filter = argv[++i];
+		else if (!std::strcmp(argv[i], "--font") && i + 1 < argc)
+			font_name = argv[++i];
+		else if (!std::strcmp(argv[i], "--size") && i + 1 < argc)
+			font_size = std::atoi(argv[++i]);
+		else
+		{
+			std::cerr << "usage: " << argv[0] << " [--repetitions N] [--filter name/corpus] [--font name] [--size px]\n";
+			return 1;
+		}
+	}
+
+	FT_Library ft;
+	FT_Init_FreeType(&ft);
+
+	Benchmark bench(repetitions, filter);
+	auto font = FontRepository::instance().getFont(font_name, font_size);
+
+	for (auto&& corpus : makeCorpora())
+	{
+		auto u32 = BaseText<>::u8_to_u32(corpus.text);
+		auto u16 = BaseText<>::u32_to_u16(u32);
+		auto& name = corpus.name;
+
+		// every distinct character misses exactly once in a fresh font
+		auto unique = u32;
+		std::sort(unique.begin(), unique.end());
+		unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+
+		// repeat short corpora, so that every sample covers a comparable amount of work
+		size_t rounds = std::max<size_t>(1, 8192 / u32.size());
+
+		// warm up the shared font, so that the hit path really hits
+		for (auto c : u32)
+			font->getGlyphSlot(c);
+
+		bench.run("glyph_slot_hit", name, u32.size() * rounds, [&]
+		{
+			for (size_t r = 0; r < rounds; ++r)
+			{
+				for (auto c : u32)
+					Benchmark::sink += font->getGlyphSlot(c) != nullptr;
+			}
+		});
+
+		bench.run("glyph_slot_miss", name, unique.size(), [&]
+		{
+			return openFreshFont(ft, font_name, font_size);
+		}, [&](auto& fresh)
+		{
+			for (auto c : unique)
+				Benchmark::sink += fresh.second->getGlyphSlot(c) != nullptr;
+		}, closeFreshFont);
+
+		bench.run("glyph_metrics_miss", name, unique.size(), [&]
+		{
+			return openFreshFont(ft, font_name, font_size);
+		}, [&](auto& fresh)
+		{
+			for (auto c : unique)
+				Benchmark::sink += fresh.second->getGlyphMetrics(c) != nullptr;
+		}, closeFreshFont);
+
+		bench.run("font_kerning", name, u32.size() * rounds, [&]
+		{
+			for (size_t r = 0; r < rounds; ++r)
+			{
+				char32_t prev_c = 0;
+				for (auto c : u32)
+				{
+					Benchmark::sink += font->getFontKerning(prev_c, c).x;
+					prev_c = c;
+				}
+			}
+		});
+
+		BenchText text(font);
+		text.setText(u32);
+		bench.run("measure_text", name, u32.size() * rounds, [&]
+		{
+			for (size_t r = 0; r < rounds; ++r)
+			{
+				text.splitText();
+				text.measureText();
+				Benchmark::sink += static_cast<uint64_t>(text.getWidth());
+			}
+		});
+
+		bench.run("make_text_composite", name, u32.size() * rounds, [&]
+		{
+			for (size_t r = 0; r < rounds; ++r)
+			{
+				text.prepareText();
+				Benchmark::sink += text.rasterText().size();
+			}
+		});
+
+		LazyText lazy(font);
+		bench.run("fit_text", name, u32.size() * rounds, [&]
+		{
+			for (size_t r = 0; r < rounds; ++r)
+			{
+				Benchmark::sink += lazy.fitText(u32, 320.0f).size();
+			}
+		});
+
+		bench.run("utf8_to_utf32", name, corpus.text.size() * rounds, [&]
+		{
+			for (size_t r = 0; r < rounds; ++r)
+			{
+				Benchmark::sink += BaseText<>::u8_to_u32(corpus.text).size();
+			}
+		});
+
+		bench.run("utf32_to_utf8", name, u32.size() * rounds, [&]
+		{
+			for (size_t r = 0; r < rounds; ++r)
+			{
+				Benchmark::sink += BaseText<>::u32_to_u8(u32).size();
+			}
+		});
+
+		bench.run("utf16_to_utf32", name, u16.size() * rounds, [&]
+		{
+			for (size_t r = 0; r < rounds; ++r)
+			{
+				Benchmark::sink += BaseText<>::u16_to_u32(u16).size();
+			}
+		});
+	}
+
+	// the whole charset of the font at a large size, as a CJK font would fill
+	// the cache: plain against compact storage, in time and in bytes per glyph
+	{
+		std::u32string charset;
+		for (char32_t c = 0; c < 0x110000; ++c)
+		{
+			if (font->hasGlyph(c))
+				charset.push_back(c);
+		}
+		const int charset_size = std::max(font_size, 48);
+		size_t live_bytes = 0;
+		auto freshFont = [&]
+		{
+			return openFreshFont(ft, font_name, charset_size);
+		};
+		auto fill = [&](auto& fresh)
+		{
+			auto before = Memory::instance().getSnapshot().getLiveBytes();
+			for (auto c : charset)
+				Benchmark::sink += fresh.second->getGlyphSlot(c) != nullptr;
+			live_bytes = Memory::instance().getSnapshot().getLiveBytes() - before;
+		};
+		bench.run("glyph_store_plain", "charset", charset.size(), freshFont, fill, closeFreshFont);
+		bench.setBytesPerOp(static_cast<double>(live_bytes) / std::max<size_t>(charset.size(), 1));
+
+		bench.run("glyph_store_compact", "charset", charset.size(), [&]
+		{
+			auto fresh = freshFont();
+			fresh.second->setCompactStorage(true);
+			return fresh;
+		}, fill, closeFreshFont);
+		bench.setBytesPerOp(static_cast<double>(live_bytes) / std::max<size_t>(charset.size(), 1));
+
+		// every lookup misses the hot cache and decodes
+		auto compact = freshFont();
+		compact.second->setCompactStorage(true, 1);
+		for (auto c : charset)
+			compact.second->getGlyphSlot(c);
+		bench.run("glyph_slot_unpack", "charset", charset.size(), [&]
+		{
+			for (auto c : charset)
+				Benchmark::sink += compact.second->getGlyphSlot(c) != nullptr;
+		});
+
+		// round trip: decoded bitmaps and reloaded outlines match plain storage byte for byte
+		auto plain = freshFont();
+		size_t mismatches = 0;
+		for (auto c : charset)
+		{
+			auto expected = plain.second->getGlyphSlot(c);
+			auto decoded = compact.second->getGlyphSlot(c);
+			if (!expected || !decoded)
+			{
+				mismatches += expected != decoded;
+				continue;
+			}
+			auto&& eb = expected->bitmap;
+			auto&& db = decoded->bitmap;
+			size_t bitmap_size = eb.rows * std::abs(eb.pitch);
+			bool same = eb.width == db.width && eb.rows == db.rows && eb.pitch == db.pitch
+				&& (bitmap_size == 0 || (eb.buffer && db.buffer && std::memcmp(eb.buffer, db.buffer, bitmap_size) == 0));
+			auto eo = plain.second->getGlyphOutline(c);
+			auto dout = compact.second->getGlyphOutline(c);
+			same = same && eo && dout && eo->n_points == dout->n_points && eo->n_contours == dout->n_contours
+				&& std::memcmp(eo->points, dout->points, eo->n_points * sizeof(FT_Vector)) == 0
+				&& std::memcmp(eo->tags, dout->tags, eo->n_points) == 0
+				&& std::memcmp(eo->contours, dout->contours, eo->n_contours * sizeof(short)) == 0;
+			mismatches += !same;
+		}
+		closeFreshFont(plain);
+		closeFreshFont(compact);
+		if (mismatches)
+		{
+			std::cerr << "compact storage round trip: " << mismatches << " of " << charset.size() << " glyphs differ\n";
+			return 1;
+		}
+	}
+
+	// first use of a font: opening and loading the ASCII glyphs, or serving them baked
+	{
+		auto&& baked = baked::NotoSans_Regular_24;
+		std::u32string ascii;
+		for (char32_t c = 0x20; c < 0x7f; ++c)
+			ascii.push_back(c);
+
+		// opened in the timed region, closed after it
+		bench.run("font_startup", "file", ascii.size(), []
+		{
+			return FreshFont{};
+		}, [&](auto& fresh)
+		{
+			fresh = openFreshFont(ft, baked.name, baked.metrics.y_ppem);
+			for (auto c : ascii)
+				Benchmark::sink += fresh.second->getGlyphSlot(c) != nullptr;
+		}, closeFreshFont);
+
+		bench.run("font_startup", "baked", ascii.size(), []
+		{
+			return std::shared_ptr<TrueTypeFont>{};
+		}, [&](auto& fresh)
+		{
+			fresh = std::make_shared<TrueTypeFont>(baked);
+			for (auto c : ascii)
+				Benchmark::sink += fresh->getGlyphSlot(c) != nullptr;
+		}, [](auto& fresh)
+		{
+			fresh.reset();
+		});
+	}
+
+	// sizing table columns: the words of the paragraph as cells, one by one or in one batch
+	{
+		std::vector<std::string> cells;
+		auto paragraph = makeCorpora().back().text;
+		size_t start = 0;
+		while (cells.size() < 50000)
+		{
+			auto end = paragraph.find_first_of(" \n", start);
+			if (end == std::string::npos)
+			{
+				cells.push_back(paragraph.substr(start));
+				start = 0;
+				continue;
+			}
+			cells.push_back(paragraph.substr(start, end - start));
+			start = end + 1;
+		}
+		std::vector<float> widths(cells.size());
+		LazyText table(font);
+
+		bench.run("measure_strings", "single", cells.size(), [&]
+		{
+			for (size_t i = 0; i < cells.size(); ++i)
+				widths[i] = table.measureString(cells[i]);
+			Benchmark::sink += static_cast<uint64_t>(widths.back());
+		});
+
+		bench.run("measure_strings", "batch", cells.size(), [&]
+		{
+			table.measureStrings(cells.data(), cells.size(), widths.data());
+			Benchmark::sink += static_cast<uint64_t>(widths.back());
+		});
+	}
+
+	// a screen of small labels drawn again unchanged: one object each, or handles of one system
+	{
+		const size_t label_count = 10000;
+		std::vector<std::unique_ptr<BasicLazyText<BaseTextRendererNull>>> labels;
+		BasicTextSystem<BaseTextRendererNull> system;
+		std::vector<BasicTextSystem<BaseTextRendererNull>::Handle> handles;
+		auto style = system.addStyle(font);
+		for (size_t i = 0; i < label_count; ++i)
+		{
+			auto text = "label " + std::to_string(i);
+			labels.emplace_back(new BasicLazyText<BaseTextRendererNull>(font));
+			labels.back()->setText(text);
+			labels.back()->drawText(0, 0);
+			handles.push_back(system.create(text, style, 0, 0));
+		}
+		system.draw();
+
+		bench.run("label_redraw", "lazy_text", label_count, [&]
+		{
+			for (auto&& label : labels)
+				label->drawText(0, 0);
+		});
+
+		bench.run("label_redraw", "text_system", label_count, [&]
+		{
+			system.draw();
+			Benchmark::sink += system.getFrameStats().drawn;
+		});
+
+		// a tenth of the labels change length every frame: packed into atlas pages, or a texture each
+		size_t frame = 0;
+		auto churn = [&]
+		{
+			frame++;
+			for (size_t i = frame % 10; i < label_count; i += 10)
+				system.setText(handles[i], (frame / 10 & 1 ? "relabelled " : "label ") + std::to_string(i));
+			system.draw();
+			Benchmark::sink += system.getFrameStats().rebuilt;
+		};
+		bench.run("label_churn", "atlas", label_count / 10, churn);
+		system.setAtlas(false);
+		system.draw();
+		bench.run("label_churn", "own_textures", label_count / 10, churn);
+	}
+
+	const size_t lookups = 1000;
+	bench.run("font_repository_get_font", "cached", lookups, [&]
+	{
+		for (size_t i = 0; i < lookups; ++i)
+			Benchmark::sink += FontRepository::instance().getFont(font_name, font_size) != nullptr;
+	});
+
+	bench.writeJson(std::cout);
+
+	FT_Done_FreeType(ft);
+}
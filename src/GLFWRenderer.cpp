@@ -1,13 +1,17 @@
 #include "GLFWRenderer.h"
+#include <algorithm>
 #include <cmath>
 #include <thread>
 #include "LazyText.h"
+#include "TextureManager.h"
+#include "NotoSans_Regular_48.h"
 
 
 GLFWRenderer::GLFWRenderer(int w, int h) : width { w }, height { h }
 {
 	glfwInit();
-	glfwWindowHint(GLFW_SAMPLES, 16);
+	// multisampling is done by the frame buffer, the back buffer only gets resolved copies
+	glfwWindowHint(GLFW_SAMPLES, 0);
 	window = glfwCreateWindow(w, h, glfwGetVersionString(), nullptr, nullptr);
 	glfwMakeContextCurrent(window);
 	glewInit();
@@ -74,6 +78,9 @@ void GLFWRenderer::run()
 			"ut labore et dolore magna aliqua.";
 		int size = 48;
 
+		// baked at build time, the font file is never opened
+		FontRepository::instance().addBakedFont(baked::NotoSans_Regular_48);
+
 		LazyText t1("NotoSans-Regular", size);
 		t1.setText(text);
 		// t1.setAlign(LazyText::TextAlign::Center);
@@ -93,10 +100,44 @@ void GLFWRenderer::run()
 		// t3.setOpacity(80);
 		// t3.setSpacing(2);
 
+		// without framebuffer objects every damaged frame is redrawn as a whole
+		createFrame();
 
 		while (!glfwWindowShouldClose(window))
 		{
 			glfwMakeContextCurrent(window);
+			resizeFrame();
+
+			// t1.setAlign(LazyText::TextAlign::Left);
+			t1.setAlign(LazyText::TextAlign::Center);
+			// t1.setAlign(LazyText::TextAlign::Right);
+			t1.setOrigin(0.5, 0.5);
+
+			// the frame is redrawn only where texts changed, not at all when none did
+			LazyText::Rect damage{ 0, 0, 0, 0 };
+			LazyText::Rect text_damage{ 0, 0, 0, 0 };
+			int cx = width / 2;
+			int cy = height / 2;
+			if (t1.takeDamage(cx, cy, text_damage))
+			{
+				// drawAll adds outlines around the text and the origin crosshair around (cx, cy)
+				damage = LazyText::unionRect(damage, { text_damage.x - 1, text_damage.y - 1, text_damage.w + 2, text_damage.h + 2 });
+				damage = LazyText::unionRect(damage, { cx - 10, cy - 10, 21, 21 });
+			}
+			if (!frame_valid || (damage.w > 0 && !frame_fbo))
+			{
+				damage = { 0, 0, width, height };
+			}
+			if (damage.w <= 0 || damage.h <= 0)
+			{
+				// nothing drawn, but retired texture storage is still recycled
+				TextureManager::instance().nextFrame();
+				sleepUntilNextFrame(15);
+				continue;
+			}
+			beginFrame(static_cast<int>(std::floor(damage.x)), static_cast<int>(std::floor(damage.y)),
+				static_cast<int>(std::ceil(damage.x + damage.w) - std::floor(damage.x)),
+				static_cast<int>(std::ceil(damage.y + damage.h) - std::floor(damage.y)));
 
 			// glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
 			// glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
@@ -127,12 +168,7 @@ void GLFWRenderer::run()
 			// t3.setText(to_string(frame_no));
 			// frame_no++;
 
-			// t1.setAlign(LazyText::TextAlign::Left);
-			t1.setAlign(LazyText::TextAlign::Center);
-			// t1.setAlign(LazyText::TextAlign::Right);
-			t1.setOrigin(0.5, 0.5);
-
-			t1.drawAll(width / 2, height / 2);
+			t1.drawAll(cx, cy);
 			// t2.drawText(width / 2, 70 + size * 2);
 			// t3.drawText(width / 2, 90 + size * 3);
 
@@ -141,9 +177,12 @@ void GLFWRenderer::run()
 			// t3.setSize(size);
 			// size++;
 
-			glfwSwapBuffers(window);
+			endFrame();
+			TextureManager::instance().nextFrame();
 			sleepUntilNextFrame(15);
 		}
+
+		destroyFrame();
 	});
 
 	while (!glfwWindowShouldClose(window))
@@ -155,6 +194,88 @@ void GLFWRenderer::run()
 		render_thread.join();
 }
 
+bool GLFWRenderer::createFrame()
+{
+	glfwGetFramebufferSize(window, &frame_w, &frame_h);
+	if (!GLEW_VERSION_3_0)
+		return false;
+
+	GLint max_samples = 0;
+	glGetIntegerv(GL_MAX_SAMPLES, &max_samples);
+	glGenRenderbuffers(1, &frame_color);
+	glBindRenderbuffer(GL_RENDERBUFFER, frame_color);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, std::min(16, static_cast<int>(max_samples)), GL_RGBA8, frame_w, frame_h);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glGenFramebuffers(1, &frame_fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, frame_fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, frame_color);
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (!complete)
+		destroyFrame();
+	return complete;
+}
+
+void GLFWRenderer::destroyFrame()
+{
+	if (frame_fbo)
+		glDeleteFramebuffers(1, &frame_fbo);
+	if (frame_color)
+		glDeleteRenderbuffers(1, &frame_color);
+	frame_fbo = 0;
+	frame_color = 0;
+	frame_valid = false;
+}
+
+void GLFWRenderer::resizeFrame()
+{
+	// a resized window gets a frame of the new size, drawn as a whole
+	glfwGetWindowSize(window, &width, &height);
+	int w = 0;
+	int h = 0;
+	glfwGetFramebufferSize(window, &w, &h);
+	if (w == frame_w && h == frame_h)
+		return;
+	destroyFrame();
+	createFrame();
+}
+
+void GLFWRenderer::beginFrame(int x, int y, int w, int h)
+{
+	if (frame_fbo == 0)
+	{
+		glViewport(0, 0, frame_w, frame_h);
+		return;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, frame_fbo);
+	glViewport(0, 0, frame_w, frame_h);
+	// framebuffer pixels, y up
+	float sx = static_cast<float>(frame_w) / width;
+	float sy = static_cast<float>(frame_h) / height;
+	int x0 = static_cast<int>(std::floor(x * sx));
+	int x1 = static_cast<int>(std::ceil((x + w) * sx));
+	int y0 = static_cast<int>(std::floor(y * sy));
+	int y1 = static_cast<int>(std::ceil((y + h) * sy));
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(x0, frame_h - y1, x1 - x0, y1 - y0);
+}
+
+void GLFWRenderer::endFrame()
+{
+	if (frame_fbo)
+	{
+		// the back buffer is undefined after a swap, it always gets the whole frame
+		glDisable(GL_SCISSOR_TEST);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, frame_fbo);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBlitFramebuffer(0, 0, frame_w, frame_h, 0, 0, frame_w, frame_h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+	frame_valid = true;
+	glfwSwapBuffers(window);
+}
+
 void GLFWRenderer::drawGrid(int xdiv, int ydiv)
 {
 	float xres = width / xdiv;
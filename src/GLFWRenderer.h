@@ -16,6 +16,15 @@ private:
 	typedef std::chrono::duration<int64_t, std::ratio<1, 60>> frame_duration;
 	std::chrono::time_point<clock, clock_resolution> next_frame{ clock::now() };
 
+private:
+	// the frame is kept in a (multisampled) framebuffer of its own: only damaged
+	// areas are redrawn into it, then it is resolved into the back buffer
+	GLuint frame_fbo{ 0 };
+	GLuint frame_color{ 0 };
+	int frame_w{ 0 };
+	int frame_h{ 0 };
+	bool frame_valid{ false };
+
 public:
 	GLFWRenderer(int width, int height);
 	~GLFWRenderer();
@@ -27,4 +36,13 @@ public:
 
 	void drawGrid(int xdiv, int ydiv);
 
+private:
+	bool createFrame();
+	void destroyFrame();
+	// recreates the frame when the framebuffer size changed
+	void resizeFrame();
+	// draws are scissored to the damaged area (screen coordinates) until endFrame
+	void beginFrame(int x, int y, int w, int h);
+	void endFrame();
+
 };
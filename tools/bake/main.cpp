@@ -0,0 +1,377 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_TRUETYPE_TABLES_H
+#include FT_TRUETYPE_TAGS_H
+
+// Font baker: rasterizes one font size and charset at build time into a header
+// of constexpr glyph metrics, kerning pairs and a coverage atlas (see BakedFont.h),
+// so the application can serve those glyphs without loading the font at all.
+// Glyphs are loaded exactly as TrueTypeFont loads them, baked and loaded text
+// composites are identical.
+
+
+struct Options
+{
+	std::string font;
+	int size{ 0 };
+	std::string charset{ "ascii" };
+	std::string name;
+	std::string output;
+};
+
+struct Glyph
+{
+	char32_t c{};
+	FT_Glyph_Metrics metrics{};
+	FT_Vector advance{};
+	FT_Pos lsb_delta{};
+	FT_Pos rsb_delta{};
+	int bitmap_left{};
+	int bitmap_top{};
+	unsigned width{};
+	unsigned rows{};
+	unsigned atlas_x{};
+	unsigned atlas_y{};
+	std::vector<uint8_t> bitmap;
+};
+
+struct Kerning
+{
+	char32_t left;
+	char32_t right;
+	FT_Vector kerning;
+};
+
+
+// glyph index pairs listed by the format 0 subtables of the 'kern' table, the
+// ones FT_Get_Kerning can return non-zero for; false for tables it cannot list
+static bool listKerningPairs(FT_Face face, std::vector<std::pair<FT_UInt, FT_UInt>>& pairs)
+{
+	FT_ULong length = 0;
+	if (FT_Load_Sfnt_Table(face, TTAG_kern, 0, nullptr, &length) || length < 4)
+		return false;
+	std::vector<uint8_t> table(length);
+	if (FT_Load_Sfnt_Table(face, TTAG_kern, 0, table.data(), &length))
+		return false;
+
+	auto u16 = [&](size_t at) { return at + 2 <= table.size() ? static_cast<unsigned>(table[at] << 8 | table[at + 1]) : 0u; };
+	auto u32 = [&](size_t at) { return static_cast<unsigned long>(u16(at)) << 16 | u16(at + 2); };
+	// version 0 (OpenType) or 1.0 (Apple), with different subtable headers
+	bool apple = u16(0) == 1;
+	size_t count = apple ? u32(4) : u16(2);
+	size_t at = apple ? 8 : 4;
+	for (size_t i = 0; i < count; ++i)
+	{
+		size_t header = apple ? 8 : 6;
+		size_t subtable_length = apple ? u32(at) : u16(at + 2);
+		unsigned format = apple ? u16(at + 4) & 0xff : u16(at + 4) >> 8;
+		if (format != 0 || at + header + 8 > table.size())
+			return false;
+
+		// the pair count may overflow its 16 bits, the table size bounds it
+		size_t start = at + header + 8;
+		size_t n = std::min<size_t>(u16(at + header), (table.size() - start) / 6);
+		for (size_t k = 0; k < n; ++k)
+			pairs.emplace_back(u16(start + k * 6), u16(start + k * 6 + 2));
+		at += apple ? subtable_length : std::max(subtable_length, start + n * 6 - at);
+	}
+	return true;
+}
+
+// non-zero pairs of the charset, sorted by left, then right: the candidates come
+// from the kern table, every glyph against every other only for tables it cannot list
+static std::vector<Kerning> bakeKerning(FT_Face face, const std::vector<Glyph>& glyphs)
+{
+	std::unordered_map<FT_UInt, std::vector<char32_t>> chars;
+	for (auto&& g : glyphs)
+		chars[FT_Get_Char_Index(face, g.c)].push_back(g.c);
+
+	std::vector<std::pair<FT_UInt, FT_UInt>> pairs;
+	if (!listKerningPairs(face, pairs))
+	{
+		pairs.clear();
+		for (auto&& left : chars)
+			for (auto&& right : chars)
+				pairs.emplace_back(left.first, right.first);
+	}
+
+	std::vector<Kerning> kerning;
+	for (auto&& pair : pairs)
+	{
+		auto left = chars.find(pair.first);
+		auto right = chars.find(pair.second);
+		if (left == chars.end() || right == chars.end())
+			continue;
+		FT_Vector k;
+		if (FT_Get_Kerning(face, pair.first, pair.second, FT_KERNING_DEFAULT, &k) || (k.x == 0 && k.y == 0))
+			continue;
+		for (auto l : left->second)
+			for (auto r : right->second)
+				kerning.push_back({ l, r, k });
+	}
+	std::sort(kerning.begin(), kerning.end(), [](const Kerning& a, const Kerning& b)
+	{
+		return a.left < b.left || (a.left == b.left && a.right < b.right);
+	});
+	kerning.erase(std::unique(kerning.begin(), kerning.end(), [](const Kerning& a, const Kerning& b)
+	{
+		return a.left == b.left && a.right == b.right;
+	}), kerning.end());
+	return kerning;
+}
+
+// "ascii", "latin1" or comma separated hexadecimal codepoints and ranges, e.g. "20-7e,a0-ff,20ac"
+static bool parseCharset(const std::string& charset, std::vector<char32_t>& out)
+{
+	std::string ranges = charset;
+	if (charset == "ascii")
+		ranges = "20-7e";
+	else if (charset == "latin1")
+		ranges = "20-7e,a0-ff";
+
+	std::stringstream ss(ranges);
+	std::string range;
+	while (std::getline(ss, range, ','))
+	{
+		char* end = nullptr;
+		unsigned long first = std::strtoul(range.c_str(), &end, 16);
+		unsigned long last = first;
+		if (end == range.c_str())
+			return false;
+		if (*end == '-')
+		{
+			const char* second = end + 1;
+			last = std::strtoul(second, &end, 16);
+			if (end == second)
+				return false;
+		}
+		if (*end != '\0' || last < first || last > 0x10ffff)
+			return false;
+		for (unsigned long c = first; c <= last; ++c)
+			out.push_back(static_cast<char32_t>(c));
+	}
+	std::sort(out.begin(), out.end());
+	out.erase(std::unique(out.begin(), out.end()), out.end());
+	return !out.empty();
+}
+
+static std::string stem(const std::string& path)
+{
+	auto slash = path.find_last_of("/\\");
+	auto name = slash == std::string::npos ? path : path.substr(slash + 1);
+	auto dot = name.find_last_of('.');
+	return dot == std::string::npos ? name : name.substr(0, dot);
+}
+
+static std::string identifier(const std::string& s)
+{
+	std::string id = s;
+	for (auto&& ch : id)
+	{
+		if (!std::isalnum(static_cast<unsigned char>(ch)))
+			ch = '_';
+	}
+	if (id.empty() || std::isdigit(static_cast<unsigned char>(id[0])))
+		id = "_" + id;
+	return id;
+}
+
+// shelves of glyphs sorted by height, in an atlas of power of two width
+static void pack(std::vector<Glyph>& glyphs, unsigned& atlas_w, unsigned& atlas_h)
+{
+	size_t area = 0;
+	for (auto&& g : glyphs)
+		area += (g.width + 1) * (g.rows + 1);
+	atlas_w = 64;
+	while (static_cast<size_t>(atlas_w) * atlas_w < area + area / 4)
+		atlas_w *= 2;
+
+	std::vector<Glyph*> order;
+	for (auto&& g : glyphs)
+		order.push_back(&g);
+	std::stable_sort(order.begin(), order.end(), [](const Glyph* a, const Glyph* b) { return a->rows > b->rows; });
+
+	unsigned x = 0, y = 0, shelf = 0;
+	for (auto g : order)
+	{
+		if (x + g->width > atlas_w)
+		{
+			x = 0;
+			y += shelf + 1;
+			shelf = 0;
+		}
+		g->atlas_x = x;
+		g->atlas_y = y;
+		x += g->width + 1;
+		shelf = std::max(shelf, g->rows);
+	}
+	atlas_h = std::max(1u, y + shelf);
+}
+
+static void writeHeader(std::ostream& os, const Options& opt, const std::string& font_name, const FT_Size_Metrics& m,
+	const std::vector<Glyph>& glyphs, const std::vector<Kerning>& kerning, const std::vector<uint8_t>& atlas, unsigned atlas_w, unsigned atlas_h)
+{
+	auto id = opt.name;
+	os << "// generated by bake.GLverse from " << stem(opt.font) << ", " << opt.size << " px, "
+		<< glyphs.size() << " glyphs, charset " << opt.charset << "; do not edit\n";
+	os << "#pragma once\n";
+	os << "#include \"BakedFont.h\"\n\n\n";
+	os << "namespace baked\n{\n";
+
+	os << "\tconstexpr BakedGlyph " << id << "_glyphs[] = {\n";
+	for (auto&& g : glyphs)
+	{
+		auto&& gm = g.metrics;
+		os << "\t\t{ 0x" << std::hex << static_cast<unsigned long>(g.c) << std::dec
+			<< ", { " << gm.width << ", " << gm.height << ", " << gm.horiBearingX << ", " << gm.horiBearingY << ", " << gm.horiAdvance
+			<< ", " << gm.vertBearingX << ", " << gm.vertBearingY << ", " << gm.vertAdvance << " }"
+			<< ", { " << g.advance.x << ", " << g.advance.y << " }"
+			<< ", " << g.lsb_delta << ", " << g.rsb_delta << ", " << g.bitmap_left << ", " << g.bitmap_top
+			<< ", " << g.width << ", " << g.rows << ", " << g.atlas_x << ", " << g.atlas_y << " },\n";
+	}
+	os << "\t};\n\n";
+
+	// arrays cannot be empty, the count tells how many pairs there are
+	os << "\tconstexpr BakedKerning " << id << "_kerning[] = {\n";
+	for (auto&& k : kerning)
+	{
+		os << "\t\t{ 0x" << std::hex << static_cast<unsigned long>(k.left) << ", 0x" << static_cast<unsigned long>(k.right) << std::dec
+			<< ", { " << k.kerning.x << ", " << k.kerning.y << " } },\n";
+	}
+	if (kerning.empty())
+		os << "\t\t{ 0, 0, { 0, 0 } },\n";
+	os << "\t};\n\n";
+
+	os << "\tconstexpr uint8_t " << id << "_atlas[] = {";
+	for (size_t i = 0; i < atlas.size(); ++i)
+	{
+		os << (i % 32 ? " " : "\n\t\t") << static_cast<unsigned>(atlas[i]) << ",";
+	}
+	os << "\n\t};\n\n";
+
+	os << "\tconstexpr BakedFont " << id << " = {\n";
+	os << "\t\t\"" << font_name << "\",\n";
+	os << "\t\t{ " << m.x_ppem << ", " << m.y_ppem << ", " << m.x_scale << ", " << m.y_scale << ", "
+		<< m.ascender << ", " << m.descender << ", " << m.height << ", " << m.max_advance << " },\n";
+	os << "\t\t" << id << "_glyphs, " << glyphs.size() << ",\n";
+	os << "\t\t" << id << "_kerning, " << kerning.size() << ",\n";
+	os << "\t\t" << id << "_atlas, " << atlas_w << ", " << atlas_h << ",\n";
+	os << "\t};\n";
+	os << "}\n";
+}
+
+int main(int argc, char **argv)
+{
+	Options opt;
+	bool usage = false;
+	for (int i = 1; i < argc && !usage; ++i)
+	{
+		auto arg = [&](const char* name) { return !std::strcmp(argv[i], name) && i + 1 < argc; };
+		if (arg("--font"))
+			opt.font = argv[++i];
+		else if (arg("--size"))
+			opt.size = std::atoi(argv[++i]);
+		else if (arg("--charset"))
+			opt.charset = argv[++i];
+		else if (arg("--name"))
+			opt.name = argv[++i];
+		else if (arg("--output"))
+			opt.output = argv[++i];
+		else
+			usage = true;
+	}
+	std::vector<char32_t> charset;
+	if (usage || opt.font.empty() || opt.size <= 0 || !parseCharset(opt.charset, charset))
+	{
+		std::cerr << "usage: " << argv[0] << " --font file.ttf --size px [--charset ascii|latin1|20-7e,...]"
+			" [--name identifier] [--output header.h]\n";
+		return 1;
+	}
+	auto font_name = stem(opt.font);
+	opt.name = identifier(opt.name.empty() ? font_name + "_" + std::to_string(opt.size) : opt.name);
+
+	FT_Library ft;
+	FT_Face face;
+	FT_Init_FreeType(&ft);
+	if (FT_New_Face(ft, opt.font.c_str(), 0, &face))
+	{
+		std::cerr << "missing font: " << opt.font << "\n";
+		return 1;
+	}
+	FT_Set_Pixel_Sizes(face, 0, opt.size);
+
+	// same load flags as TrueTypeFont::getGlyphSlot
+	std::vector<Glyph> glyphs;
+	for (auto c : charset)
+	{
+		if (FT_Get_Char_Index(face, c) == 0 || FT_Load_Char(face, c, FT_LOAD_RENDER | FT_LOAD_TARGET_LIGHT))
+			continue;
+
+		auto slot = face->glyph;
+		Glyph g;
+		g.c = c;
+		g.metrics = slot->metrics;
+		g.advance = slot->advance;
+		g.lsb_delta = slot->lsb_delta;
+		g.rsb_delta = slot->rsb_delta;
+		g.bitmap_left = slot->bitmap_left;
+		g.bitmap_top = slot->bitmap_top;
+		g.width = slot->bitmap.width;
+		g.rows = slot->bitmap.rows;
+		g.bitmap.resize(static_cast<size_t>(g.width) * g.rows);
+		for (unsigned y = 0; y < g.rows; ++y)
+		{
+			std::memcpy(&g.bitmap[static_cast<size_t>(y) * g.width], slot->bitmap.buffer + slot->bitmap.pitch * static_cast<int>(y), g.width);
+		}
+		glyphs.push_back(std::move(g));
+	}
+
+	std::vector<Kerning> kerning;
+	if (FT_HAS_KERNING(face))
+	{
+		kerning = bakeKerning(face, glyphs);
+	}
+
+	unsigned atlas_w = 0, atlas_h = 0;
+	pack(glyphs, atlas_w, atlas_h);
+	std::vector<uint8_t> atlas(static_cast<size_t>(atlas_w) * atlas_h, 0);
+	for (auto&& g : glyphs)
+	{
+		for (unsigned y = 0; y < g.rows; ++y)
+		{
+			std::memcpy(&atlas[static_cast<size_t>(g.atlas_y + y) * atlas_w + g.atlas_x], &g.bitmap[static_cast<size_t>(y) * g.width], g.width);
+		}
+	}
+
+	std::stringstream header;
+	writeHeader(header, opt, font_name, face->size->metrics, glyphs, kerning, atlas, atlas_w, atlas_h);
+	FT_Done_Face(face);
+	FT_Done_FreeType(ft);
+
+	if (opt.output.empty())
+	{
+		std::cout << header.str();
+		return 0;
+	}
+	std::ofstream out(opt.output, std::ios::binary);
+	out << header.str();
+	if (!out)
+	{
+		std::cerr << "cannot write " << opt.output << "\n";
+		return 1;
+	}
+	std::cerr << opt.output << ": " << glyphs.size() << " glyphs, " << kerning.size() << " kerning pairs, atlas " << atlas_w << "x" << atlas_h << "\n";
+	return 0;
+}
@@ -0,0 +1,145 @@
+#include "ImageWriter.h"
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <fstream>
+
+
+namespace
+{
+	uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+	{
+		static const auto table = []
+		{
+			std::array<uint32_t, 256> t{};
+			for (uint32_t n = 0; n < 256; ++n)
+			{
+				uint32_t c = n;
+				for (int k = 0; k < 8; ++k)
+					c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+				t[n] = c;
+			}
+			return t;
+		}();
+
+		crc = ~crc;
+		for (size_t i = 0; i < size; ++i)
+			crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+		return ~crc;
+	}
+
+	uint32_t adler32(const uint8_t* data, size_t size)
+	{
+		uint32_t a = 1, b = 0;
+		for (size_t i = 0; i < size; ++i)
+		{
+			a = (a + data[i]) % 65521;
+			b = (b + a) % 65521;
+		}
+		return (b << 16) | a;
+	}
+
+	void put32(std::vector<uint8_t>& out, uint32_t v)
+	{
+		out.push_back(static_cast<uint8_t>(v >> 24));
+		out.push_back(static_cast<uint8_t>(v >> 16));
+		out.push_back(static_cast<uint8_t>(v >> 8));
+		out.push_back(static_cast<uint8_t>(v));
+	}
+
+	void putChunk(std::ofstream& os, const char* type, const std::vector<uint8_t>& data)
+	{
+		std::vector<uint8_t> chunk;
+		put32(chunk, static_cast<uint32_t>(data.size()));
+		chunk.insert(chunk.end(), type, type + 4);
+		chunk.insert(chunk.end(), data.begin(), data.end());
+		put32(chunk, crc32(chunk.data() + 4, chunk.size() - 4));
+		os.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+	}
+}
+
+bool ImageWriter::formatFromPath(const std::string& path, Format& format)
+{
+	auto dot = path.rfind('.');
+	if (dot == std::string::npos)
+		return false;
+
+	auto ext = path.substr(dot + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	if (ext == "pgm")
+		format = Format::PGM;
+	else if (ext == "png")
+		format = Format::PNG;
+	else if (ext == "raw")
+		format = Format::Raw;
+	else
+		return false;
+	return true;
+}
+
+bool ImageWriter::write(const std::string& path, const GrayImage& image, Format format)
+{
+	switch (format)
+	{
+	case Format::PGM: return writePGM(path, image);
+	case Format::PNG: return writePNG(path, image);
+	case Format::Raw: return writeRaw(path, image);
+	}
+	return false;
+}
+
+bool ImageWriter::writePGM(const std::string& path, const GrayImage& image)
+{
+	std::ofstream os(path, std::ios::binary);
+	os << "P5\n" << image.width << " " << image.height << "\n255\n";
+	os.write(reinterpret_cast<const char*>(image.pixels.data()), image.pixels.size());
+	return static_cast<bool>(os);
+}
+
+bool ImageWriter::writePNG(const std::string& path, const GrayImage& image)
+{
+	// grayscale PNG with "stored" (uncompressed) deflate blocks, no zlib needed
+	std::vector<uint8_t> raw;
+	raw.reserve((image.width + 1) * image.height);
+	for (size_t y = 0; y < image.height; ++y)
+	{
+		raw.push_back(0); // filter: none
+		auto row = image.pixels.begin() + y * image.width;
+		raw.insert(raw.end(), row, row + image.width);
+	}
+
+	std::vector<uint8_t> idat{ 0x78, 0x01 };
+	size_t pos = 0;
+	do {
+		size_t len = std::min<size_t>(raw.size() - pos, 65535);
+		bool last = pos + len == raw.size();
+		idat.push_back(last ? 1 : 0);
+		idat.push_back(static_cast<uint8_t>(len));
+		idat.push_back(static_cast<uint8_t>(len >> 8));
+		idat.push_back(static_cast<uint8_t>(~len));
+		idat.push_back(static_cast<uint8_t>(~len >> 8));
+		idat.insert(idat.end(), raw.begin() + pos, raw.begin() + pos + len);
+		pos += len;
+	} while (pos < raw.size());
+	put32(idat, adler32(raw.data(), raw.size()));
+
+	std::vector<uint8_t> ihdr;
+	put32(ihdr, static_cast<uint32_t>(image.width));
+	put32(ihdr, static_cast<uint32_t>(image.height));
+	ihdr.insert(ihdr.end(), { 8, 0, 0, 0, 0 }); // 8-bit, grayscale, deflate, adaptive, no interlace
+
+	std::ofstream os(path, std::ios::binary);
+	const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	os.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+	putChunk(os, "IHDR", ihdr);
+	putChunk(os, "IDAT", idat);
+	putChunk(os, "IEND", {});
+	return static_cast<bool>(os);
+}
+
+bool ImageWriter::writeRaw(const std::string& path, const GrayImage& image)
+{
+	std::ofstream os(path, std::ios::binary);
+	os.write(reinterpret_cast<const char*>(image.pixels.data()), image.pixels.size());
+	return static_cast<bool>(os);
+}
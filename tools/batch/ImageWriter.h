@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// 8-bit single channel (coverage) image
+struct GrayImage
+{
+	size_t width{};
+	size_t height{};
+	std::vector<uint8_t> pixels;
+};
+
+
+class ImageWriter
+{
+public:
+	enum class Format {
+		PGM,
+		PNG,
+		Raw,
+	};
+
+public:
+	static bool formatFromPath(const std::string& path, Format& format);
+
+	static bool write(const std::string& path, const GrayImage& image, Format format);
+	static bool writePGM(const std::string& path, const GrayImage& image);
+	static bool writePNG(const std::string& path, const GrayImage& image);
+	static bool writeRaw(const std::string& path, const GrayImage& image);
+
+};
@@ -0,0 +1,229 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ImageWriter.h"
+#include "LazyText.h"
+
+// Job list: one job per line, tab separated, '#' starts a comment line
+//   output <TAB> font <TAB> size <TAB> wrap <TAB> align <TAB> text
+// wrap is the maximum line length in pixels (0 disables wrapping),
+// align is one of left/center/right, text understands \n, \t and \\ escapes
+// and may be empty (a blank image of one line).
+
+
+struct Job
+{
+	std::string output;
+	std::string font;
+	int size{};
+	float wrap{};
+	LazyText::TextAlign align{ LazyText::TextAlign::Left };
+	std::string text;
+};
+
+
+class BatchText : public LazyText
+{
+public:
+	using LazyText::LazyText;
+
+public:
+	// CPU-only path: layout and composite, no GL context required
+	GrayImage render(const StringType& s, float wrap, TextAlign align)
+	{
+		BaseText::setText(wrap > 0 ? fitText(s, wrap) : s);
+		text_align = align;
+		prepareText();
+		GrayImage image;
+		if (s.empty())
+		{
+			// an empty label is blank, one line of the font high
+			layoutTexture();
+			image.width = (text_border.x * 2) >> 6;
+			image.height = (text_size + text_border.y * 2) >> 6;
+			image.pixels.assign(image.width * image.height, 0);
+			return image;
+		}
+
+		auto buffer = rasterText();
+		image.width = std::min<size_t>(buffer.get_w(), (text_width + text_border.x * 2) >> 6);
+		image.height = std::min<size_t>(buffer.get_h(), (text_height + text_border.y * 2) >> 6);
+		image.pixels.resize(image.width * image.height);
+		for (size_t y = 0; y < image.height; ++y)
+		{
+			for (size_t x = 0; x < image.width; ++x)
+			{
+				image.pixels[y * image.width + x] = buffer.at(x, y).a;
+			}
+		}
+		return image;
+	}
+};
+
+
+static std::string unescape(const std::string& s)
+{
+	std::string out;
+	for (size_t i = 0; i < s.size(); ++i)
+	{
+		if (s[i] == '\\' && i + 1 < s.size())
+		{
+			switch (s[++i])
+			{
+			case 'n': out += '\n'; break;
+			case 't': out += '\t'; break;
+			default: out += s[i]; break;
+			}
+		}
+		else
+		{
+			out += s[i];
+		}
+	}
+	return out;
+}
+
+static bool parseJob(const std::string& line, Job& job)
+{
+	// the text is everything after the fifth tab, an empty label included
+	std::vector<std::string> fields;
+	size_t start = 0;
+	while (fields.size() < 5)
+	{
+		auto tab = line.find('\t', start);
+		if (tab == std::string::npos)
+			return false;
+		fields.push_back(line.substr(start, tab - start));
+		start = tab + 1;
+	}
+	auto field = line.substr(start);
+
+	job.output = fields[0];
+	job.font = fields[1];
+	job.size = std::atoi(fields[2].c_str());
+	job.wrap = static_cast<float>(std::atof(fields[3].c_str()));
+	if (fields[4] == "center")
+		job.align = LazyText::TextAlign::Center;
+	else if (fields[4] == "right")
+		job.align = LazyText::TextAlign::Right;
+	else
+		job.align = LazyText::TextAlign::Left;
+	job.text = unescape(field);
+	return job.size > 0;
+}
+
+int main(int argc, char **argv)
+{
+	std::string jobs_path;
+	std::string format_name;
+	size_t threads = std::max(1u, std::thread::hardware_concurrency());
+	bool verbose = false;
+	bool usage = false;
+	for (int i = 1; i < argc && !usage; ++i)
+	{
+		if (!std::strcmp(argv[i], "--jobs") && i + 1 < argc)
+			threads = std::max(1, std::atoi(argv[++i]));
+		else if (!std::strcmp(argv[i], "--format") && i + 1 < argc)
+			format_name = argv[++i];
+		else if (!std::strcmp(argv[i], "--verbose"))
+			verbose = true;
+		else if (jobs_path.empty() && argv[i][0] != '-')
+			jobs_path = argv[i];
+		else
+			usage = true;
+	}
+	if (usage || jobs_path.empty())
+	{
+		std::cerr << "usage: " << argv[0] << " [--jobs N] [--format pgm|png|raw] [--verbose] joblist.tsv\n";
+		return 1;
+	}
+
+	ImageWriter::Format forced_format{};
+	bool force_format = !format_name.empty();
+	if (force_format && !ImageWriter::formatFromPath("." + format_name, forced_format))
+	{
+		std::cerr << "unknown format: " << format_name << "\n";
+		return 1;
+	}
+
+	std::ifstream jobs_file(jobs_path);
+	if (!jobs_file)
+	{
+		std::cerr << "cannot open job list: " << jobs_path << "\n";
+		return 1;
+	}
+
+	std::vector<Job> jobs;
+	std::string line;
+	for (size_t line_no = 1; std::getline(jobs_file, line); ++line_no)
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+		Job job;
+		if (!parseJob(line, job))
+		{
+			std::cerr << jobs_path << ":" << line_no << ": malformed job\n";
+			return 1;
+		}
+		jobs.push_back(job);
+	}
+
+	std::atomic<size_t> next_job{ 0 };
+	std::atomic<size_t> failed{ 0 };
+	std::atomic<uint64_t> pixels{ 0 };
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> workers;
+	for (size_t t = 0; t < std::min(threads, jobs.size()); ++t)
+	{
+		workers.emplace_back([&]
+		{
+			for (size_t i = next_job++; i < jobs.size(); i = next_job++)
+			{
+				auto&& job = jobs[i];
+				try
+				{
+					ImageWriter::Format format = forced_format;
+					if (!force_format && !ImageWriter::formatFromPath(job.output, format))
+						throw std::runtime_error("unknown output format");
+
+					BatchText text(job.font, job.size);
+					auto image = text.render(BatchText::u8_to_u32(job.text), job.wrap, job.align);
+					if (!ImageWriter::write(job.output, image, format))
+						throw std::runtime_error("write failed");
+
+					pixels += image.pixels.size();
+					if (verbose)
+						std::printf("%s %zux%zu\n", job.output.c_str(), image.width, image.height);
+				}
+				catch (std::exception& e)
+				{
+					failed++;
+					std::string what = e.what();
+					if (!what.empty() && what.back() == '\n')
+						what.pop_back();
+					std::fprintf(stderr, "%s: %s\n", job.output.c_str(), what.c_str());
+				}
+			}
+		});
+	}
+	for (auto&& worker : workers)
+		worker.join();
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	size_t done = jobs.size() - failed;
+	std::printf("rendered %zu/%zu images in %.3f s using %zu threads: %.1f images/s, %.1f Mpx/s\n",
+		done, jobs.size(), elapsed.count(), std::min(threads, jobs.size()),
+		elapsed.count() > 0 ? done / elapsed.count() : 0.0,
+		elapsed.count() > 0 ? pixels / elapsed.count() / 1e6 : 0.0);
+	return failed ? 2 : 0;
+}
@@ -0,0 +1,357 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "BaseTextRendererNull.h"
+#include "FontRepository.h"
+#include "LazyText.h"
+#include "TextTextureCache.h"
+#include "TextureManager.h"
+
+// Scenario runner: builds a scene of many labels, drives a fixed number of
+// frames without pacing and reports frame time percentiles together with the
+// CPU time spent in layout, raster and upload.
+//
+// Without --gl everything runs against the null renderer (no window, no GL),
+// with --gl labels are drawn into a hidden GLFW window.
+
+
+enum class Scenario {
+	Static,   // set once, never changes
+	Ticker,   // a fraction of labels gets new text every frame
+	Churn,    // every label gets new text every frame
+	FontSize, // a fraction of labels animates its font size
+};
+
+struct Options
+{
+	Scenario scenario{ Scenario::Ticker };
+	std::string scenario_name{ "ticker" };
+	size_t labels{ 5000 };
+	size_t frames{ 300 };
+	float update_rate{ 0.1f };
+	std::string font{ "NotoSans-Regular" };
+	int size{ 14 };
+	int width{ 1920 };
+	int height{ 1080 };
+	unsigned seed{ 1 };
+	bool gl{ false };
+	std::string prepare{ "inline" };
+	size_t distinct{ 0 }; // labels showing the same texts, 0: every label its own
+};
+
+struct Report
+{
+	std::vector<double> frame_ms;
+	Statistics::Snapshot stats;
+	std::array<size_t, LazyText::TextStageCount> stage_runs{};
+	uint64_t draws{};
+	std::vector<uint64_t> frame_allocations;
+	Memory::Snapshot memory;
+	size_t shared_textures{};
+	uint64_t texture_hits{};
+	uint64_t texture_misses{};
+};
+
+// per-frame upload figures of the GL backend, as reported by the texture manager
+struct UploadReport
+{
+	uint64_t frames{};
+	uint64_t uploads{};
+	uint64_t staged_uploads{};
+	uint64_t bytes{};
+	uint64_t max_frame_bytes{};
+	double latency_ms{};
+	double max_latency_ms{};
+};
+
+
+static double percentile(std::vector<double> v, double p)
+{
+	if (v.empty())
+		return 0.0;
+	std::sort(v.begin(), v.end());
+	auto i = static_cast<size_t>(p / 100.0 * (v.size() - 1) + 0.5);
+	return v[std::min(i, v.size() - 1)];
+}
+
+static std::string tickerText(size_t label, std::mt19937& rng)
+{
+	char buffer[64];
+	std::uniform_real_distribution<double> price(0.0, 9999.0);
+	std::snprintf(buffer, sizeof(buffer), "SYM%04zu %9.3f", label % 10000, price(rng));
+	return buffer;
+}
+
+template <typename Renderer>
+Report runScenario(const Options& opt, std::function<void()> begin_frame, std::function<void()> end_frame)
+{
+	typedef BasicLazyText<Renderer> TextType;
+	std::mt19937 rng(opt.seed);
+	// with --distinct, labels i and i + distinct show the same text in every frame
+	auto labelText = [&](size_t i, size_t frame)
+	{
+		if (opt.distinct == 0)
+			return tickerText(i, rng);
+		std::mt19937 slot_rng(opt.seed + static_cast<unsigned>((i % opt.distinct) * 7919 + frame * 104729));
+		return tickerText(i % opt.distinct, slot_rng);
+	};
+	std::vector<std::unique_ptr<TextType>> labels;
+	labels.reserve(opt.labels);
+	for (size_t i = 0; i < opt.labels; ++i)
+	{
+		labels.push_back(std::make_unique<TextType>(opt.font, opt.size));
+		if (opt.prepare == "background")
+			labels.back()->setPrepareMode(TextType::PrepareMode::Background);
+		else if (opt.prepare == "wait")
+			labels.back()->setPrepareMode(TextType::PrepareMode::BackgroundWait);
+		labels.back()->setText(labelText(i, 0));
+	}
+
+	// layout of the scene: a dense grid, wrapping around the viewport
+	const int cell_w = opt.size * 12;
+	const int cell_h = opt.size * 2;
+	const int columns = std::max(1, opt.width / cell_w);
+	auto position = [&](size_t i, int& x, int& y)
+	{
+		x = static_cast<int>(i % columns) * cell_w;
+		y = static_cast<int>((i / columns) * cell_h) % std::max(cell_h, opt.height);
+	};
+
+	const size_t updates = std::max<size_t>(1, static_cast<size_t>(opt.labels * opt.update_rate));
+	std::uniform_int_distribution<size_t> pick(0, opt.labels - 1);
+
+	FontRepository::instance().resetStatistics();
+	FontRepository::instance().resetMemoryStatistics();
+	auto draws_before = BaseTextRendererNull::getDrawCount();
+	auto cache_before = TextTextureCache<Renderer>::instance().getUsage();
+
+	Report report;
+	report.frame_ms.reserve(opt.frames);
+	report.frame_allocations.reserve(opt.frames);
+	for (size_t frame = 0; frame < opt.frames; ++frame)
+	{
+		auto allocations = FontRepository::instance().getMemoryStatistics().getAllocations();
+		auto start = std::chrono::steady_clock::now();
+		begin_frame();
+
+		switch (opt.scenario)
+		{
+		case Scenario::Static:
+			break;
+		case Scenario::Ticker:
+			for (size_t u = 0; u < updates; ++u)
+			{
+				auto i = pick(rng);
+				labels[i]->setText(labelText(i, frame));
+			}
+			break;
+		case Scenario::Churn:
+			for (size_t i = 0; i < labels.size(); ++i)
+				labels[i]->setText(labelText(i, frame));
+			break;
+		case Scenario::FontSize:
+			for (size_t u = 0; u < updates; ++u)
+			{
+				auto i = pick(rng);
+				labels[i]->setFontSize(opt.size + static_cast<int>((frame + i) % 16));
+			}
+			break;
+		}
+
+		for (size_t i = 0; i < labels.size(); ++i)
+		{
+			int x, y;
+			position(i, x, y);
+			labels[i]->drawText(x, y);
+		}
+
+		end_frame();
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		report.frame_ms.push_back(elapsed.count());
+		report.frame_allocations.push_back(FontRepository::instance().getMemoryStatistics().getAllocations() - allocations);
+	}
+
+	report.stats = FontRepository::instance().getStatistics();
+	report.memory = FontRepository::instance().getMemoryStatistics();
+	report.draws = BaseTextRendererNull::getDrawCount() - draws_before;
+	auto cache = TextTextureCache<Renderer>::instance().getUsage();
+	report.shared_textures = cache.entries;
+	report.texture_hits = cache.hits - cache_before.hits;
+	report.texture_misses = cache.misses - cache_before.misses;
+	for (auto&& label : labels)
+	{
+		auto runs = label->getStageRuns();
+		for (size_t s = 0; s < runs.size(); ++s)
+			report.stage_runs[s] += runs[s];
+	}
+	return report;
+}
+
+static void writeReport(const Options& opt, const Report& r, const UploadReport& u = {})
+{
+	double total_ms = 0;
+	for (auto ms : r.frame_ms)
+		total_ms += ms;
+	auto ms = [](uint64_t ns) { return ns / 1e6; };
+	const char* stage_names[] = { "decode", "wrap", "split", "measure", "raster", "upload" };
+
+	std::printf("{\n");
+	std::printf("\t\"scenario\": \"%s\",\n", opt.scenario_name.c_str());
+	std::printf("\t\"backend\": \"%s\",\n", opt.gl ? "gl" : "null");
+	std::printf("\t\"prepare\": \"%s\",\n", opt.prepare.c_str());
+	std::printf("\t\"labels\": %zu,\n", opt.labels);
+	std::printf("\t\"frames\": %zu,\n", opt.frames);
+	std::printf("\t\"update_rate\": %.3f,\n", opt.update_rate);
+	std::printf("\t\"frame_ms\": { \"mean\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f },\n",
+		r.frame_ms.empty() ? 0.0 : total_ms / r.frame_ms.size(),
+		percentile(r.frame_ms, 50), percentile(r.frame_ms, 95), percentile(r.frame_ms, 99), percentile(r.frame_ms, 100));
+	std::printf("\t\"cpu_ms\": { \"layout\": %.3f, \"raster\": %.3f, \"upload\": %.3f, \"glyph_load\": %.3f },\n",
+		ms(r.stats[Stat::LayoutNs]), ms(r.stats[Stat::CompositeNs]), ms(r.stats[Stat::UploadNs]), ms(r.stats[Stat::GlyphLoadNs]));
+	std::printf("\t\"stage_runs\": {");
+	for (size_t s = 0; s < r.stage_runs.size(); ++s)
+		std::printf("%s \"%s\": %zu", s ? "," : "", stage_names[s], r.stage_runs[s]);
+	std::printf(" },\n");
+	if (!opt.gl)
+		std::printf("\t\"draws\": %llu,\n", static_cast<unsigned long long>(r.draws));
+	if (opt.gl)
+		std::printf("\t\"uploads\": { \"frames\": %llu, \"uploads\": %llu, \"staged\": %llu, \"bytes_per_frame\": %.0f,"
+			" \"max_bytes_per_frame\": %llu, \"latency_ms\": %.3f, \"max_latency_ms\": %.3f },\n",
+			static_cast<unsigned long long>(u.frames), static_cast<unsigned long long>(u.uploads),
+			static_cast<unsigned long long>(u.staged_uploads), u.frames ? static_cast<double>(u.bytes) / u.frames : 0.0,
+			static_cast<unsigned long long>(u.max_frame_bytes), u.uploads ? u.latency_ms / u.uploads : 0.0, u.max_latency_ms);
+	uint64_t total_allocations = 0, max_allocations = 0;
+	for (auto n : r.frame_allocations)
+	{
+		total_allocations += n;
+		max_allocations = std::max(max_allocations, n);
+	}
+	std::printf("\t\"texture_cache\": { \"entries\": %zu, \"hits\": %llu, \"misses\": %llu },\n", r.shared_textures,
+		static_cast<unsigned long long>(r.texture_hits), static_cast<unsigned long long>(r.texture_misses));
+	std::printf("\t\"allocations_per_frame\": { \"mean\": %.1f, \"max\": %llu },\n",
+		r.frame_allocations.empty() ? 0.0 : static_cast<double>(total_allocations) / r.frame_allocations.size(),
+		static_cast<unsigned long long>(max_allocations));
+	std::printf("\t\"memory\": ");
+	r.memory.writeJson(std::cout);
+	std::printf(",\n");
+	std::printf("\t\"statistics\": ");
+	r.stats.writeJson(std::cout);
+	std::printf("\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+	Options opt;
+	bool usage = false;
+	for (int i = 1; i < argc && !usage; ++i)
+	{
+		auto arg = [&](const char* name) { return !std::strcmp(argv[i], name) && i + 1 < argc; };
+		if (arg("--scenario"))
+		{
+			opt.scenario_name = argv[++i];
+			if (opt.scenario_name == "static")
+				opt.scenario = Scenario::Static;
+			else if (opt.scenario_name == "ticker")
+				opt.scenario = Scenario::Ticker;
+			else if (opt.scenario_name == "churn")
+				opt.scenario = Scenario::Churn;
+			else if (opt.scenario_name == "fontsize")
+				opt.scenario = Scenario::FontSize;
+			else
+				usage = true;
+		}
+		else if (arg("--labels"))
+			opt.labels = std::max(1, std::atoi(argv[++i]));
+		else if (arg("--frames"))
+			opt.frames = std::max(1, std::atoi(argv[++i]));
+		else if (arg("--rate"))
+			opt.update_rate = static_cast<float>(std::atof(argv[++i]));
+		else if (arg("--font"))
+			opt.font = argv[++i];
+		else if (arg("--size"))
+			opt.size = std::max(1, std::atoi(argv[++i]));
+		else if (arg("--seed"))
+			opt.seed = std::atoi(argv[++i]);
+		else if (arg("--distinct"))
+			opt.distinct = std::max(0, std::atoi(argv[++i]));
+		else if (arg("--prepare"))
+		{
+			opt.prepare = argv[++i];
+			usage = opt.prepare != "inline" && opt.prepare != "background" && opt.prepare != "wait";
+		}
+		else if (!std::strcmp(argv[i], "--gl"))
+			opt.gl = true;
+		else
+			usage = true;
+	}
+	if (usage)
+	{
+		std::cerr << "usage: " << argv[0] << " [--scenario static|ticker|churn|fontsize] [--labels N] [--frames N]"
+			" [--rate fraction] [--font name] [--size px] [--seed N] [--prepare inline|background|wait] [--distinct N] [--gl]\n";
+		return 1;
+	}
+
+	auto nothing = [] {};
+	if (!opt.gl)
+	{
+		writeReport(opt, runScenario<BaseTextRendererNull>(opt, nothing, nothing));
+		return 0;
+	}
+
+	glfwInit();
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	auto window = glfwCreateWindow(opt.width, opt.height, "stress.GLverse", nullptr, nullptr);
+	if (window == nullptr)
+	{
+		std::cerr << "cannot create a GL context, run without --gl for the headless backend\n";
+		glfwTerminate();
+		return 1;
+	}
+	glfwMakeContextCurrent(window);
+	glewInit();
+
+	auto begin_frame = [&]
+	{
+		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+		glMatrixMode(GL_PROJECTION);
+		glLoadIdentity();
+		glOrtho(0, opt.width, opt.height, 0, 0, 1);
+		glMatrixMode(GL_MODELVIEW);
+		glLoadIdentity();
+	};
+	UploadReport uploads;
+	uint64_t reported_frame = ~0ull;
+	auto end_frame = [&]
+	{
+		glFinish();
+		glfwSwapBuffers(window);
+		TextureManager::instance().nextFrame();
+		auto f = TextureManager::instance().getFrameStats();
+		if (f.frame != reported_frame && f.uploads)
+		{
+			reported_frame = f.frame;
+			uploads.frames++;
+			uploads.uploads += f.uploads;
+			uploads.staged_uploads += f.staged_uploads;
+			uploads.bytes += f.upload_bytes;
+			uploads.max_frame_bytes = std::max(uploads.max_frame_bytes, f.upload_bytes);
+			uploads.latency_ms += f.latency_ms * f.uploads;
+			uploads.max_latency_ms = std::max(uploads.max_latency_ms, f.max_latency_ms);
+		}
+	};
+	{
+		auto report = runScenario<BaseTextRendererGL2>(opt, begin_frame, end_frame);
+		writeReport(opt, report, uploads);
+	}
+	glfwDestroyWindow(window);
+	glfwTerminate();
+}